@@ -0,0 +1,375 @@
+// Audio
+// Renders the sound of each frame on its own thread, to a real-time output or a WAV file. The ring
+// between the threads holds one program_sound_t per frame; the producer only ever writes head and
+// the consumer only ever writes tail, so neither side takes a lock.
+//
+// The pattern is a square-ish wave, so it's synthesized with band-limited steps (BLEP): every
+// transition adds a precomputed, band-limited step at its exact sub-sample position instead of a
+// hard edge, which keeps the harmonics above Nyquist from aliasing back down. The step table and the
+// per-pitch phase increments are built once and shared read-only by every instance; rendering is
+// integer table lookups only.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdatomic.h>
+
+#include "audio.h"
+#include "thread.h"
+
+#define AUDIO_RING_SIZE 256		  // Frames queued ahead of the audio thread; a power of two
+#define AUDIO_CACHE_LINE 64
+#define AUDIO_IDLE_SECONDS 0.002  // Audio thread sleep while the ring is empty
+#define AUDIO_OUTPUT_QUEUED 4	  // Frames an output may fall behind before the oldest are skipped
+#define AUDIO_AMPLITUDE 8192
+#define AUDIO_PATTERN_BITS 128
+#define AUDIO_WAV_HEADER_SIZE 44
+
+// Band-limited step: a windowed sinc spanning AUDIO_BLEP_WIDTH samples either side of the edge,
+// tabulated at AUDIO_BLEP_PHASES sub-sample positions. Each row holds the step's increase over
+// AUDIO_BLEP_TAPS consecutive output samples, in AUDIO_BLEP_ONE fixed point, and sums to exactly
+// AUDIO_BLEP_ONE, so edges never leave DC drift behind. Output lags by AUDIO_BLEP_WIDTH samples.
+#define AUDIO_BLEP_WIDTH 8
+#define AUDIO_BLEP_TAPS (AUDIO_BLEP_WIDTH * 2 + 1)
+#define AUDIO_BLEP_PHASES 64
+#define AUDIO_BLEP_SHIFT 15
+#define AUDIO_BLEP_ONE (1 << AUDIO_BLEP_SHIFT)
+#define AUDIO_BLEP_CUTOFF 0.9	  // Fraction of Nyquist
+#define AUDIO_BLEP_RING 32		  // Pending step increments; a power of two above AUDIO_BLEP_TAPS
+
+// Pattern position is 16.16 fixed point, in pattern samples
+#define AUDIO_PHASE_SHIFT 16
+#define AUDIO_PHASE_MASK ((AUDIO_PATTERN_BITS << AUDIO_PHASE_SHIFT) - 1)
+
+static int32_t audio_blep[AUDIO_BLEP_PHASES][AUDIO_BLEP_TAPS];
+static uint32_t audio_pitch_steps[256]; // Pattern samples per output sample for each pitch, 16.16
+static thread_once_t audio_tables_once = THREAD_ONCE_INIT;
+
+typedef struct audio_t
+{
+	// Each index on its own cache line, so the threads don't bounce one line between them
+	atomic_uint head;	  // Next slot the emulation thread fills
+	uint8_t head_pad[AUDIO_CACHE_LINE - sizeof(atomic_uint)];
+	atomic_uint tail;	  // Next slot the audio thread reads
+	uint8_t tail_pad[AUDIO_CACHE_LINE - sizeof(atomic_uint)];
+	program_sound_t ring[AUDIO_RING_SIZE];
+
+	atomic_bool closing;  // Set once the producer is done; the thread drains the ring and exits
+	thread_t thread;
+	uint32_t dropped;	  // Producer side only
+
+	// Audio thread only. Output goes to exactly one of these.
+	FILE* wav;
+	audio_output_t device; // Real-time output, used when write is set
+	uint32_t samples;	  // Written to the file so far
+	uint32_t phase;		  // Position in the pattern, 16.16
+	int32_t level;		  // Level the last edge stepped to
+	int32_t output;		  // Running sum of step increments, in AUDIO_BLEP_ONE units
+	uint32_t cursor;	  // Ring slot of the next output sample
+	int32_t pending[AUDIO_BLEP_RING]; // Step increments for the coming output samples
+} audio_t;
+
+// Builds the shared tables. Runs once, before the first audio thread starts.
+static void audio_build_tables()
+{
+	const double pi = 3.14159265358979323846;
+	const int span = AUDIO_BLEP_WIDTH * AUDIO_BLEP_PHASES;
+
+	// Integrate the windowed sinc into a step, sampled every 1 / AUDIO_BLEP_PHASES of a sample over
+	// -AUDIO_BLEP_WIDTH to +AUDIO_BLEP_WIDTH
+	static double step[AUDIO_BLEP_WIDTH * AUDIO_BLEP_PHASES * 2 + 1];
+	double sum = 0.0, prev = 0.0;
+	for (int i = -span; i <= span; i++)
+	{
+		double t = (double)i / AUDIO_BLEP_PHASES;
+		double x = pi * AUDIO_BLEP_CUTOFF * t;
+		double sinc = i == 0 ? 1.0 : sin(x) / x;
+		double window = 0.42 + 0.5 * cos(pi * t / AUDIO_BLEP_WIDTH) + 0.08 * cos(2.0 * pi * t / AUDIO_BLEP_WIDTH);
+		double h = sinc * window;
+
+		if (i > -span)
+			sum += (h + prev) * 0.5;
+		step[i + span] = sum;
+		prev = h;
+	}
+
+	// An edge a fraction f into output sample 0 is centred at AUDIO_BLEP_WIDTH + f; tap k is how much
+	// the step rises between output samples k and k + 1
+	for (int p = 0; p < AUDIO_BLEP_PHASES; p++)
+	{
+		int total = 0;
+		for (int k = 0; k < AUDIO_BLEP_TAPS; k++)
+		{
+			int hi = (k + 1) * AUDIO_BLEP_PHASES - p;
+			int lo = k * AUDIO_BLEP_PHASES - p;
+			double b_hi = hi < 0 ? 0.0 : hi > span * 2 ? sum : step[hi];
+			double b_lo = lo < 0 ? 0.0 : lo > span * 2 ? sum : step[lo];
+			int32_t tap = (int32_t)((b_hi - b_lo) / sum * AUDIO_BLEP_ONE + 0.5);
+			audio_blep[p][k] = tap;
+			total += tap;
+		}
+
+		// Rounding goes into the centre tap so every row sums to exactly one
+		audio_blep[p][AUDIO_BLEP_WIDTH] += AUDIO_BLEP_ONE - total;
+	}
+
+	for (int pitch = 0; pitch < 256; pitch++)
+	{
+		double rate = 4000.0 * pow(2.0, (pitch - 64) / 48.0);
+		audio_pitch_steps[pitch] = (uint32_t)(rate / AUDIO_SAMPLE_RATE * (1 << AUDIO_PHASE_SHIFT) + 0.5);
+	}
+}
+
+static void audio_put16(uint8_t* dest, uint16_t value)
+{
+	dest[0] = value & 0xFF;
+	dest[1] = value >> 8;
+}
+
+static void audio_put32(uint8_t* dest, uint32_t value)
+{
+	for (int i = 0; i < 4; i++)
+		dest[i] = (uint8_t)(value >> (i * 8));
+}
+
+// 16-bit mono PCM; the sizes are filled in once the length is known
+static void audio_write_wav_header(FILE* file, uint32_t samples)
+{
+	uint8_t header[AUDIO_WAV_HEADER_SIZE];
+	memcpy(header, "RIFF", 4);
+	audio_put32(header + 4, 36 + samples * 2);
+	memcpy(header + 8, "WAVEfmt ", 8);
+	audio_put32(header + 16, 16);
+	audio_put16(header + 20, 1);
+	audio_put16(header + 22, 1);
+	audio_put32(header + 24, AUDIO_SAMPLE_RATE);
+	audio_put32(header + 28, AUDIO_SAMPLE_RATE * 2);
+	audio_put16(header + 32, 2);
+	audio_put16(header + 34, 16);
+	memcpy(header + 36, "data", 4);
+	audio_put32(header + 40, samples * 2);
+
+	fwrite(header, 1, sizeof(header), file);
+}
+
+static int32_t audio_pattern_level(const program_sound_t* sound, uint32_t bit)
+{
+	bit &= AUDIO_PATTERN_BITS - 1;
+	return (sound->pattern[bit >> 3] >> (7 - (bit & 7))) & 1 ? AUDIO_AMPLITUDE : -AUDIO_AMPLITUDE;
+}
+
+// Adds a band-limited edge to the given level, fraction / AUDIO_BLEP_PHASES of the way into the
+// output sample about to be produced.
+static void audio_add_edge(audio_t* audio, int32_t level, uint32_t fraction)
+{
+	int32_t delta = level - audio->level;
+	if (delta == 0)
+		return;
+
+	const int32_t* taps = audio_blep[fraction];
+	for (int k = 0; k < AUDIO_BLEP_TAPS; k++)
+		audio->pending[(audio->cursor + k) & (AUDIO_BLEP_RING - 1)] += delta * taps[k];
+
+	audio->level = level;
+}
+
+// Plays the pattern at its pitch, one bit per pattern sample, or silence while the timer is off.
+// Every change of level becomes a band-limited edge at its sub-sample position.
+static void audio_render(audio_t* audio, const program_sound_t* sound, int16_t* out, uint32_t count)
+{
+	uint32_t step = audio_pitch_steps[sound->pitch];
+
+	// Switching on or off is an edge at the start of the frame
+	audio_add_edge(audio, sound->on ? audio_pattern_level(sound, audio->phase >> AUDIO_PHASE_SHIFT) : 0, 0);
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (sound->on)
+		{
+			// Every pattern sample that starts during this output sample is a potential edge
+			uint32_t next = audio->phase + step;
+			for (uint32_t bit = (audio->phase >> AUDIO_PHASE_SHIFT) + 1; bit <= next >> AUDIO_PHASE_SHIFT; bit++)
+			{
+				uint32_t into = (bit << AUDIO_PHASE_SHIFT) - audio->phase;
+				uint32_t fraction = (uint32_t)((uint64_t)into * AUDIO_BLEP_PHASES / step);
+				audio_add_edge(audio, audio_pattern_level(sound, bit), fraction < AUDIO_BLEP_PHASES ? fraction : AUDIO_BLEP_PHASES - 1);
+			}
+			audio->phase = next & AUDIO_PHASE_MASK;
+		}
+
+		uint32_t slot = audio->cursor & (AUDIO_BLEP_RING - 1);
+		audio->output += audio->pending[slot];
+		audio->pending[slot] = 0;
+		audio->cursor++;
+
+		int32_t sample = audio->output >> AUDIO_BLEP_SHIFT;
+		out[i] = (int16_t)(sample > INT16_MAX ? INT16_MAX : sample < INT16_MIN ? INT16_MIN : sample);
+	}
+}
+
+static void audio_write(audio_t* audio, const int16_t* samples, uint32_t count)
+{
+	if (audio->device.write)
+	{
+		audio->device.write(audio->device.context, samples, count);
+		return;
+	}
+
+	uint8_t bytes[AUDIO_FRAME_SAMPLES * 2];
+	for (uint32_t i = 0; i < count; i++)
+		audio_put16(bytes + i * 2, (uint16_t)samples[i]);
+
+	fwrite(bytes, 2, count, audio->wav);
+	audio->samples += count;
+}
+
+static int audio_thread_main(void* arg)
+{
+	audio_t* audio = arg;
+	int16_t samples[AUDIO_FRAME_SAMPLES];
+
+	for (;;)
+	{
+		unsigned tail = atomic_load_explicit(&audio->tail, memory_order_relaxed);
+		if (tail == atomic_load_explicit(&audio->head, memory_order_acquire))
+		{
+			// Closing is set after the last push, so an empty ring seen after it is empty for good
+			if (atomic_load(&audio->closing) && tail == atomic_load_explicit(&audio->head, memory_order_acquire))
+				break;
+
+			thread_sleep(AUDIO_IDLE_SECONDS);
+			continue;
+		}
+
+		// An output plays in real time, so a backlog only adds latency: when the emulation has run
+		// ahead (its clock and the output's drift apart), skip to the latest frames
+		unsigned head = atomic_load_explicit(&audio->head, memory_order_acquire);
+		if (audio->device.write && head - tail > AUDIO_OUTPUT_QUEUED)
+			tail = head - AUDIO_OUTPUT_QUEUED;
+
+		program_sound_t sound = audio->ring[tail % AUDIO_RING_SIZE];
+		atomic_store_explicit(&audio->tail, tail + 1, memory_order_release);
+
+		audio_render(audio, &sound, samples, AUDIO_FRAME_SAMPLES);
+		audio_write(audio, samples, AUDIO_FRAME_SAMPLES);
+	}
+
+	return 0;
+}
+
+static audio_t* audio_alloc()
+{
+	thread_once(&audio_tables_once, audio_build_tables);
+
+	audio_t* audio = calloc(1, sizeof(audio_t));
+	if (audio == NULL)
+	{
+		fprintf(stderr, "Audio: failed to allocate memory for object\n");
+		return NULL;
+	}
+
+	atomic_init(&audio->head, 0);
+	atomic_init(&audio->tail, 0);
+	atomic_init(&audio->closing, false);
+	return audio;
+}
+
+// Closes whatever the audio thread was writing to.
+static void audio_close_output(audio_t* audio)
+{
+	if (audio->device.close)
+		audio->device.close(audio->device.context);
+
+	if (audio->wav)
+	{
+		fseek(audio->wav, 0, SEEK_SET);
+		audio_write_wav_header(audio->wav, audio->samples);
+		fclose(audio->wav);
+	}
+}
+
+static audio_t* audio_start(audio_t* audio)
+{
+	if (!thread_create(&audio->thread, audio_thread_main, audio))
+	{
+		fprintf(stderr, "Audio: failed to start audio thread\n");
+		audio_close_output(audio);
+		free(audio);
+		return NULL;
+	}
+
+	return audio;
+}
+
+audio_t* audio_open_output(const audio_output_t* output)
+{
+	audio_t* audio = audio_alloc();
+	if (audio == NULL)
+	{
+		if (output->close)
+			output->close(output->context);
+		return NULL;
+	}
+
+	audio->device = *output;
+	return audio_start(audio);
+}
+
+audio_t* audio_open_wav(const char* path)
+{
+	audio_t* audio = audio_alloc();
+	if (audio == NULL)
+		return NULL;
+
+	audio->wav = fopen(path, "wb");
+	if (audio->wav == NULL)
+	{
+		fprintf(stderr, "Audio: couldn't open %s for writing\n", path);
+		free(audio);
+		return NULL;
+	}
+
+	audio_write_wav_header(audio->wav, 0);
+	return audio_start(audio);
+}
+
+bool audio_push(audio_t* audio, const program_t* program)
+{
+	unsigned head = atomic_load_explicit(&audio->head, memory_order_relaxed);
+	if (head - atomic_load_explicit(&audio->tail, memory_order_acquire) == AUDIO_RING_SIZE)
+	{
+		audio->dropped++;
+		return false;
+	}
+
+	program_sound(program, &audio->ring[head % AUDIO_RING_SIZE]);
+	atomic_store_explicit(&audio->head, head + 1, memory_order_release);
+	return true;
+}
+
+void audio_push_wait(audio_t* audio, const program_t* program)
+{
+	unsigned head = atomic_load_explicit(&audio->head, memory_order_relaxed);
+	while (head - atomic_load_explicit(&audio->tail, memory_order_acquire) == AUDIO_RING_SIZE)
+		thread_yield();
+
+	audio_push(audio, program);
+}
+
+uint32_t audio_dropped(const audio_t* audio)
+{
+	return audio->dropped;
+}
+
+void audio_close(audio_t* audio)
+{
+	if (audio == NULL)
+		return;
+
+	atomic_store(&audio->closing, true);
+	thread_join(&audio->thread);
+
+	audio_close_output(audio);
+	free(audio);
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+// Audio. The emulation thread hands the sound of each 60 Hz frame to a dedicated audio thread
+// through a single-producer, single-consumer lock-free ring; the audio thread turns it into 16-bit
+// mono PCM and plays it through an output or writes it out. Pushing never takes a lock or waits on
+// the audio thread. Output devices belong to the window frontend (see audio_device.h).
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "program.h"
+
+#define AUDIO_SAMPLE_RATE 44100
+#define AUDIO_FRAME_SAMPLES (AUDIO_SAMPLE_RATE / 60) // Output samples per emulated frame
+
+typedef struct audio_t audio_t;
+
+// Output that plays samples in real time. The audio thread writes one frame of samples at a time
+// and the output may block while it's full; close plays out what's queued.
+typedef struct audio_output_t
+{
+	void* context;
+	void (*write)(void* context, const int16_t* samples, uint32_t count);
+	void (*close)(void* context);
+} audio_output_t;
+
+// Starts the audio thread, playing through the output, which it takes over (and closes if the
+// thread can't be started). Returns NULL on failure. Frames that queue up behind the output are
+// skipped, so sound stays within a few frames of the emulation.
+audio_t* audio_open_output(const audio_output_t* output);
+
+// Starts the audio thread, writing its output to a WAV file. Returns NULL if the file can't be
+// opened or the thread can't be started.
+audio_t* audio_open_wav(const char* path);
+
+// Queues the program's sound for the frame just run (see program_sound). Call once per frame, from
+// one thread. Returns false, dropping the frame, if the audio thread is too far behind.
+bool audio_push(audio_t* audio, const program_t* program);
+
+// Like audio_push, but waits for room instead of dropping the frame. For offline runs, where every
+// frame has to reach the output.
+void audio_push_wait(audio_t* audio, const program_t* program);
+
+// Frames dropped by audio_push so far.
+uint32_t audio_dropped(const audio_t* audio);
+
+// Lets the audio thread finish the queued frames, stops it and closes the output.
+void audio_close(audio_t* audio);
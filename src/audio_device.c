@@ -0,0 +1,232 @@
+// Audio output devices
+// Each backend only needs to take a frame of samples at a time and block while its buffers are
+// full; the audio thread's pace then follows the device.
+
+#if !defined(_WIN32) && !defined(__APPLE__)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "audio_device.h"
+
+#if defined(_WIN32)
+#include <Windows.h>
+#include <mmsystem.h>
+
+#define AUDIO_DEVICE_BUFFERS 4
+
+typedef struct audio_device_t
+{
+	HWAVEOUT wave;
+	HANDLE done;		// Signalled by the device each time it finishes a buffer
+	WAVEHDR headers[AUDIO_DEVICE_BUFFERS];
+	int16_t buffers[AUDIO_DEVICE_BUFFERS][AUDIO_DEVICE_MAX_WRITE];
+	uint32_t next;		// Buffer the next write goes to
+} audio_device_t;
+
+audio_device_t* audio_device_open(uint32_t sample_rate)
+{
+	audio_device_t* device = calloc(1, sizeof(audio_device_t));
+	if (device == NULL)
+		return NULL;
+
+	device->done = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+	WAVEFORMATEX format = { 0 };
+	format.wFormatTag = WAVE_FORMAT_PCM;
+	format.nChannels = 1;
+	format.nSamplesPerSec = sample_rate;
+	format.nAvgBytesPerSec = sample_rate * 2;
+	format.nBlockAlign = 2;
+	format.wBitsPerSample = 16;
+
+	if (device->done == NULL
+		|| waveOutOpen(&device->wave, WAVE_MAPPER, &format, (DWORD_PTR)device->done, 0, CALLBACK_EVENT) != MMSYSERR_NOERROR)
+	{
+		fprintf(stderr, "Audio: couldn't open the output device\n");
+		if (device->done)
+			CloseHandle(device->done);
+		free(device);
+		return NULL;
+	}
+
+	for (int i = 0; i < AUDIO_DEVICE_BUFFERS; i++)
+		device->headers[i].dwFlags = WHDR_DONE;
+
+	return device;
+}
+
+static void audio_device_wait(audio_device_t* device, WAVEHDR* header)
+{
+	while (!(header->dwFlags & WHDR_DONE))
+		WaitForSingleObject(device->done, INFINITE);
+
+	if (header->dwFlags & WHDR_PREPARED)
+		waveOutUnprepareHeader(device->wave, header, sizeof(WAVEHDR));
+}
+
+void audio_device_write(audio_device_t* device, const int16_t* samples, uint32_t count)
+{
+	WAVEHDR* header = &device->headers[device->next];
+	audio_device_wait(device, header);
+
+	memcpy(device->buffers[device->next], samples, count * sizeof(int16_t));
+	memset(header, 0, sizeof(WAVEHDR));
+	header->lpData = (LPSTR)device->buffers[device->next];
+	header->dwBufferLength = count * sizeof(int16_t);
+	waveOutPrepareHeader(device->wave, header, sizeof(WAVEHDR));
+	waveOutWrite(device->wave, header, sizeof(WAVEHDR));
+
+	device->next = (device->next + 1) % AUDIO_DEVICE_BUFFERS;
+}
+
+void audio_device_close(audio_device_t* device)
+{
+	for (int i = 0; i < AUDIO_DEVICE_BUFFERS; i++)
+		audio_device_wait(device, &device->headers[i]);
+
+	waveOutClose(device->wave);
+	CloseHandle(device->done);
+	free(device);
+}
+
+#elif !defined(__APPLE__)
+#include <dlfcn.h>
+
+// The few ALSA calls needed, declared here so that libasound is only needed at run time
+#define AUDIO_ALSA_LIBRARY "libasound.so.2"
+#define AUDIO_ALSA_STREAM_PLAYBACK 0
+#define AUDIO_ALSA_FORMAT_S16_LE 2
+#define AUDIO_ALSA_ACCESS_RW_INTERLEAVED 3
+#define AUDIO_ALSA_LATENCY_US 50000
+
+typedef struct audio_alsa_pcm_t audio_alsa_pcm_t;
+
+typedef struct audio_device_t
+{
+	void* library;
+	audio_alsa_pcm_t* pcm;
+
+	int (*pcm_open)(audio_alsa_pcm_t** pcm, const char* name, int stream, int mode);
+	int (*pcm_set_params)(audio_alsa_pcm_t* pcm, int format, int access, unsigned channels, unsigned rate, int soft_resample, unsigned latency);
+	long (*pcm_writei)(audio_alsa_pcm_t* pcm, const void* buffer, unsigned long frames);
+	int (*pcm_recover)(audio_alsa_pcm_t* pcm, int error, int silent);
+	int (*pcm_drain)(audio_alsa_pcm_t* pcm);
+	int (*pcm_close)(audio_alsa_pcm_t* pcm);
+} audio_device_t;
+
+audio_device_t* audio_device_open(uint32_t sample_rate)
+{
+	void* library = dlopen(AUDIO_ALSA_LIBRARY, RTLD_NOW | RTLD_LOCAL);
+	if (library == NULL)
+	{
+		fprintf(stderr, "Audio: couldn't load %s, sound is off\n", AUDIO_ALSA_LIBRARY);
+		return NULL;
+	}
+
+	audio_device_t* device = calloc(1, sizeof(audio_device_t));
+	if (device == NULL)
+	{
+		dlclose(library);
+		return NULL;
+	}
+
+	device->library = library;
+	*(void**)&device->pcm_open = dlsym(library, "snd_pcm_open");
+	*(void**)&device->pcm_set_params = dlsym(library, "snd_pcm_set_params");
+	*(void**)&device->pcm_writei = dlsym(library, "snd_pcm_writei");
+	*(void**)&device->pcm_recover = dlsym(library, "snd_pcm_recover");
+	*(void**)&device->pcm_drain = dlsym(library, "snd_pcm_drain");
+	*(void**)&device->pcm_close = dlsym(library, "snd_pcm_close");
+
+	if (device->pcm_open == NULL || device->pcm_set_params == NULL || device->pcm_writei == NULL
+		|| device->pcm_recover == NULL || device->pcm_drain == NULL || device->pcm_close == NULL
+		|| device->pcm_open(&device->pcm, "default", AUDIO_ALSA_STREAM_PLAYBACK, 0) < 0)
+	{
+		fprintf(stderr, "Audio: couldn't open the output device\n");
+		dlclose(library);
+		free(device);
+		return NULL;
+	}
+
+	if (device->pcm_set_params(device->pcm, AUDIO_ALSA_FORMAT_S16_LE, AUDIO_ALSA_ACCESS_RW_INTERLEAVED, 1, sample_rate, 1, AUDIO_ALSA_LATENCY_US) < 0)
+	{
+		fprintf(stderr, "Audio: the output device doesn't take 16-bit mono at %u Hz\n", sample_rate);
+		audio_device_close(device);
+		return NULL;
+	}
+
+	return device;
+}
+
+void audio_device_write(audio_device_t* device, const int16_t* samples, uint32_t count)
+{
+	while (count > 0)
+	{
+		long written = device->pcm_writei(device->pcm, samples, count);
+		if (written < 0)
+		{
+			// Underruns (the emulation fell behind) are recovered from; anything else drops the rest
+			if (device->pcm_recover(device->pcm, (int)written, 1) < 0)
+				return;
+			continue;
+		}
+
+		samples += written;
+		count -= (uint32_t)written;
+	}
+}
+
+void audio_device_close(audio_device_t* device)
+{
+	device->pcm_drain(device->pcm);
+	device->pcm_close(device->pcm);
+	dlclose(device->library);
+	free(device);
+}
+
+#else
+typedef struct audio_device_t
+{
+	int unused;
+} audio_device_t;
+
+audio_device_t* audio_device_open(uint32_t sample_rate)
+{
+	fprintf(stderr, "Audio: no output device support on this platform, sound is off\n");
+	return NULL;
+}
+
+void audio_device_write(audio_device_t* device, const int16_t* samples, uint32_t count)
+{
+}
+
+void audio_device_close(audio_device_t* device)
+{
+}
+#endif
+
+_Static_assert(AUDIO_FRAME_SAMPLES <= AUDIO_DEVICE_MAX_WRITE, "A frame has to fit in one device write");
+
+static void audio_device_output_write(void* device, const int16_t* samples, uint32_t count)
+{
+	audio_device_write(device, samples, count);
+}
+
+static void audio_device_output_close(void* device)
+{
+	audio_device_close(device);
+}
+
+audio_t* audio_open_device()
+{
+	audio_device_t* device = audio_device_open(AUDIO_SAMPLE_RATE);
+	if (device == NULL)
+		return NULL;
+
+	audio_output_t output = { .context = device, .write = audio_device_output_write, .close = audio_device_output_close };
+	return audio_open_output(&output);
+}
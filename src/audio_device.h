@@ -0,0 +1,29 @@
+#pragma once
+
+// Audio output devices. Blocking writes of 16-bit mono PCM to the system's default output: ALSA on
+// Linux, loaded at run time so it isn't a build dependency, and waveOut on Windows. Part of the
+// window frontend rather than the core; the audio thread drives a device as its audio_output_t.
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "audio.h"
+
+typedef struct audio_device_t audio_device_t;
+
+// Opens the default output device at the given sample rate. Returns NULL if there isn't one, or
+// none is supported on this platform.
+audio_device_t* audio_device_open(uint32_t sample_rate);
+
+// Queues samples for playback, waiting while the device's buffer is full. At most
+// AUDIO_DEVICE_MAX_WRITE samples per call.
+void audio_device_write(audio_device_t* device, const int16_t* samples, uint32_t count);
+
+// Plays out what's queued and closes the device.
+void audio_device_close(audio_device_t* device);
+
+#define AUDIO_DEVICE_MAX_WRITE 1024
+
+// Starts the audio thread, playing on the default output device. Returns NULL if there's no device
+// or the thread can't be started.
+audio_t* audio_open_device();
@@ -0,0 +1,388 @@
+// Batch runner. Runs many ROMs on a pool of worker threads, one independent program per ROM, and
+// writes a table of results.
+
+#ifndef _WIN32
+#define _DEFAULT_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+#include "program.h"
+#include "scheduler.h"
+#include "replay.h"
+#include "thread.h"
+
+#define DEFAULT_FRAMES 600
+#define MAX_THREADS 256
+
+typedef struct job_t
+{
+	char* path;
+
+	// Results
+	bool loaded;
+	bool replay_mismatch; // Not the ROM the replay was recorded with; not run
+	program_run_t run;
+	uint64_t hash;
+	double wall_ms;
+} job_t;
+
+// Contiguous slice of the job list. The owner and thieves both claim jobs with a fetch-add, so a
+// worker that runs out of its own slice can take from any other without locks.
+typedef struct shard_t
+{
+	atomic_size_t next;
+	size_t end;
+} shard_t;
+
+typedef struct batch_t
+{
+	job_t* jobs;
+	size_t job_count;
+	size_t job_capacity;
+
+	shard_t shards[MAX_THREADS];
+	int thread_count;
+
+	uint64_t cycles;
+	uint64_t frames;
+	uint64_t ips;
+	program_platform_t platform;
+	bool platform_given;
+	bool jit;
+	const replay_t* replay; // Keys fed to the ROM it was recorded with, frame by frame; shared by every worker
+} batch_t;
+
+typedef struct worker_t
+{
+	batch_t* batch;
+	int id;
+} worker_t;
+
+static void usage()
+{
+	fprintf(stderr, "Usage: vc-chip8-batch [--threads <n>] [--frames <n> | --cycles <n>] [--ips <n>] [--platform chip8|schip|xochip] [--jit] [--replay <file>] [--out <file>] <rom|dir>...\n");
+}
+
+static int cpu_count()
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return (int)info.dwNumberOfProcessors;
+#else
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (int)count : 1;
+#endif
+}
+
+static void add_job(batch_t* batch, const char* path)
+{
+	if (batch->job_count == batch->job_capacity)
+	{
+		batch->job_capacity = batch->job_capacity ? batch->job_capacity * 2 : 64;
+		batch->jobs = realloc(batch->jobs, sizeof(job_t) * batch->job_capacity);
+		if (batch->jobs == NULL)
+		{
+			fprintf(stderr, "Batch: failed to allocate job list\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	job_t* job = &batch->jobs[batch->job_count++];
+	memset(job, 0, sizeof(*job));
+	job->path = malloc(strlen(path) + 1);
+	if (job->path == NULL)
+	{
+		fprintf(stderr, "Batch: failed to allocate job list\n");
+		exit(EXIT_FAILURE);
+	}
+	strcpy(job->path, path);
+}
+
+// Adds every file directly inside the directory. Returns false if path isn't a directory.
+static bool add_dir(batch_t* batch, const char* path)
+{
+	char file_path[4096];
+
+#ifdef _WIN32
+	char pattern[4096];
+	snprintf(pattern, sizeof(pattern), "%s\\*", path);
+
+	WIN32_FIND_DATAA data;
+	HANDLE find = FindFirstFileA(pattern, &data);
+	if (find == INVALID_HANDLE_VALUE)
+		return false;
+
+	do
+	{
+		if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			continue;
+
+		snprintf(file_path, sizeof(file_path), "%s\\%s", path, data.cFileName);
+		add_job(batch, file_path);
+	} while (FindNextFileA(find, &data));
+
+	FindClose(find);
+#else
+	DIR* dir = opendir(path);
+	if (dir == NULL)
+		return false;
+
+	struct dirent* entry;
+	while ((entry = readdir(dir)) != NULL)
+	{
+		snprintf(file_path, sizeof(file_path), "%s/%s", path, entry->d_name);
+
+		struct stat info;
+		if (stat(file_path, &info) == 0 && S_ISREG(info.st_mode))
+			add_job(batch, file_path);
+	}
+
+	closedir(dir);
+#endif
+
+	return true;
+}
+
+static int compare_jobs(const void* a, const void* b)
+{
+	return strcmp(((const job_t*)a)->path, ((const job_t*)b)->path);
+}
+
+// Runs the given frames with the replay's keys. Frames where the program is idle in FX0A cost
+// nothing: the run returns at once until the replay releases a key.
+static program_run_t run_replay(scheduler_t* scheduler, program_t* program, const replay_t* replay, uint64_t frames)
+{
+	program_run_t total = { .cycles = 0, .reason = k_program_stop_budget };
+
+	for (uint32_t frame = 0; frame < frames; frame++)
+	{
+		scheduler_set_keys(scheduler, replay_keys_at(replay, frame));
+		program_run_t run = scheduler_step_frame(scheduler, program);
+		total.cycles += run.cycles;
+		total.reason = run.reason;
+	}
+
+	return total;
+}
+
+static void run_job(batch_t* batch, job_t* job)
+{
+	double start = scheduler_now();
+
+	program_t* program = program_init_platform(job->path, batch->platform);
+	scheduler_t* scheduler = scheduler_init(batch->ips);
+
+	if (program && scheduler)
+	{
+		if (batch->jit)
+			program_set_backend(program, k_program_backend_jit);
+
+		if (batch->replay && !replay_matches(batch->replay, program))
+			job->replay_mismatch = true;
+		else if (batch->replay)
+			job->run = run_replay(scheduler, program, batch->replay, batch->frames);
+		else
+			job->run = scheduler_run_budget(scheduler, program, batch->cycles, batch->frames);
+
+		job->hash = program_display_hash(program);
+		job->loaded = true;
+	}
+
+	scheduler_terminate(scheduler);
+	program_destroy(program);
+
+	job->wall_ms = (scheduler_now() - start) * 1000.0;
+}
+
+// Claims the next job of a shard, or returns false if it's empty.
+static bool claim(shard_t* shard, size_t* job)
+{
+	if (atomic_load_explicit(&shard->next, memory_order_relaxed) >= shard->end)
+		return false;
+
+	*job = atomic_fetch_add_explicit(&shard->next, 1, memory_order_relaxed);
+	return *job < shard->end;
+}
+
+static int worker_main(void* arg)
+{
+	worker_t* worker = arg;
+	batch_t* batch = worker->batch;
+	size_t job;
+
+	// Own shard first, then steal from the others in order
+	for (int i = 0; i < batch->thread_count; i++)
+	{
+		shard_t* shard = &batch->shards[(worker->id + i) % batch->thread_count];
+		while (claim(shard, &job))
+			run_job(batch, &batch->jobs[job]);
+	}
+
+	return 0;
+}
+
+static void write_results(batch_t* batch, FILE* out)
+{
+	static const char* reasons[] = { "budget", "draw", "key_wait", "error", "exit" };
+
+	fprintf(out, "rom\tstatus\tcycles\tframebuffer_hash\twall_ms\n");
+	for (size_t i = 0; i < batch->job_count; i++)
+	{
+		job_t* job = &batch->jobs[i];
+		fprintf(out, "%s\t%s\t%llu\t%016llx\t%.3f\n",
+			job->path,
+			!job->loaded ? "load_failed" : job->replay_mismatch ? "replay_mismatch" : reasons[job->run.reason],
+			(unsigned long long)job->run.cycles,
+			(unsigned long long)job->hash,
+			job->wall_ms);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	batch_t batch = { 0 };
+	batch.ips = SCHEDULER_DEFAULT_IPS;
+	batch.thread_count = cpu_count();
+	char* out_path = NULL;
+	char* replay_path = NULL;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+			batch.thread_count = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--cycles") == 0 && i + 1 < argc)
+			batch.cycles = strtoull(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+			batch.frames = strtoull(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--ips") == 0 && i + 1 < argc)
+			batch.ips = strtoull(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--platform") == 0 && i + 1 < argc)
+		{
+			if (!program_platform_from_name(argv[++i], &batch.platform))
+			{
+				usage();
+				return EXIT_FAILURE;
+			}
+			batch.platform_given = true;
+		}
+		else if (strcmp(argv[i], "--jit") == 0)
+			batch.jit = true;
+		else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+			replay_path = argv[++i];
+		else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc)
+			out_path = argv[++i];
+		else if (argv[i][0] == '-')
+		{
+			usage();
+			return EXIT_FAILURE;
+		}
+		else if (!add_dir(&batch, argv[i]))
+			add_job(&batch, argv[i]);
+	}
+
+	// A replay brings its own rate and platform, and runs to its end unless told to stop sooner. It
+	// only runs the ROM it was recorded with; other ROMs are reported as mismatches. It's read once,
+	// here, and only read from by the workers.
+	replay_t* replay = NULL;
+	if (replay_path)
+	{
+		replay = replay_open(replay_path);
+		if (replay == NULL)
+			return EXIT_FAILURE;
+
+		if (batch.platform_given && batch.platform != replay_platform(replay))
+		{
+			fprintf(stderr, "Batch: %s was recorded on %s\n", replay_path, program_platform_name(replay_platform(replay)));
+			return EXIT_FAILURE;
+		}
+
+		batch.platform = replay_platform(replay);
+		batch.ips = replay_ips(replay);
+		if (batch.frames == 0 || batch.frames > replay_frames(replay))
+			batch.frames = replay_frames(replay);
+		batch.cycles = 0;
+		batch.replay = replay;
+	}
+
+	if (batch.job_count == 0 || batch.ips == SCHEDULER_UNLIMITED)
+	{
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	if (batch.cycles == 0 && batch.frames == 0)
+		batch.frames = DEFAULT_FRAMES;
+
+	if (batch.thread_count < 1)
+		batch.thread_count = 1;
+	if (batch.thread_count > MAX_THREADS)
+		batch.thread_count = MAX_THREADS;
+	if ((size_t)batch.thread_count > batch.job_count)
+		batch.thread_count = (int)batch.job_count;
+
+	qsort(batch.jobs, batch.job_count, sizeof(job_t), compare_jobs);
+
+	// Split the jobs into one shard per worker
+	for (int i = 0; i < batch.thread_count; i++)
+	{
+		atomic_init(&batch.shards[i].next, batch.job_count * i / batch.thread_count);
+		batch.shards[i].end = batch.job_count * (i + 1) / batch.thread_count;
+	}
+
+	// The decode table is shared; build it before any worker creates a program
+	program_decode_init();
+
+	double start = scheduler_now();
+
+	thread_t threads[MAX_THREADS];
+	worker_t workers[MAX_THREADS];
+	for (int i = 0; i < batch.thread_count; i++)
+	{
+		workers[i].batch = &batch;
+		workers[i].id = i;
+		if (!thread_create(&threads[i], worker_main, &workers[i]))
+		{
+			fprintf(stderr, "Batch: failed to start worker thread\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	for (int i = 0; i < batch.thread_count; i++)
+		thread_join(&threads[i]);
+
+	double elapsed = scheduler_now() - start;
+
+	FILE* out = out_path ? fopen(out_path, "w") : stdout;
+	if (out == NULL)
+	{
+		fprintf(stderr, "Batch: couldn't open %s\n", out_path);
+		return EXIT_FAILURE;
+	}
+
+	write_results(&batch, out);
+	if (out != stdout)
+		fclose(out);
+
+	fprintf(stderr, "Batch: %zu ROMs on %d threads in %.3f s\n", batch.job_count, batch.thread_count, elapsed);
+
+	for (size_t i = 0; i < batch.job_count; i++)
+		free(batch.jobs[i].path);
+	free(batch.jobs);
+	replay_close(replay, 0);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,360 @@
+// Benchmarks. Times synthetic loops of each opcode family, then any ROMs given on the command line,
+// and writes a table of throughput figures that can be compared between builds.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "program.h"
+#include "scheduler.h"
+#include "wide.h"
+
+#define DEFAULT_CYCLES 2000000
+#define DEFAULT_TRIALS 10
+#define WARMUP_CYCLES 10000
+#define DEFAULT_LANES 64
+#define STATE_OPS 2000 // Saves or loads per trial in the state rows
+
+// Synthetic programs. Each is an endless loop exercising one opcode family
+typedef struct micro_t
+{
+	const char* name;
+	const uint16_t* code;
+	size_t length;
+} micro_t;
+
+static const uint16_t k_alu[] =
+{
+	0x6001, 0x6103, 0x8014, 0x8115, 0x8021, 0x8122, 0x8033, 0x8104,
+	0x8016, 0x810E, 0x8017, 0x8120, 0x7005, 0x71FB, 0x8314, 0x8235,
+	0x1200,
+};
+
+static const uint16_t k_jumps[] =
+{
+	0x1202, 0x1204, 0x1206, 0x1208, 0x120A, 0x120C, 0x120E, 0x1200,
+};
+
+// One-row sprites from the font
+static const uint16_t k_drw_small[] =
+{
+	0xA050, 0xD011, 0x7008, 0x7103, 0xD011, 0x7008, 0x7103, 0x1202,
+};
+
+// Fifteen-row sprites, crossing the clip edge as the coordinates drift
+static const uint16_t k_drw_large[] =
+{
+	0xA050, 0xD01F, 0x7009, 0x7105, 0xD01F, 0x7009, 0x7105, 0x1202,
+};
+
+static const uint16_t k_bcd[] =
+{
+	0xA300, 0x6089, 0xF033, 0x7001, 0xF033, 0x7001, 0x1204,
+};
+
+// FX55/FX65 advance I, so the loop resets it before the stores reach the code
+static const uint16_t k_mem[] =
+{
+	0xA300, 0xFF55, 0xFF65, 0x7001, 0xFF55, 0xFF65, 0x1200,
+};
+
+#define MICRO(name, code) { name, code, sizeof(code) / sizeof(code[0]) }
+
+static const micro_t k_micros[] =
+{
+	MICRO("alu", k_alu),
+	MICRO("jumps", k_jumps),
+	MICRO("drw_small", k_drw_small),
+	MICRO("drw_large", k_drw_large),
+	MICRO("bcd", k_bcd),
+	MICRO("fx55_fx65", k_mem),
+};
+
+typedef struct bench_t
+{
+	uint64_t cycles; // Per trial
+	int trials;
+	bool jit;
+	uint32_t lanes;	 // Machines in the lockstep rows; 0 skips them
+	FILE* out;
+} bench_t;
+
+static void usage()
+{
+	fprintf(stderr, "Usage: vc-chip8-bench [--cycles <n>] [--trials <n>] [--jit] [--lanes <n>] [--out <file>] [rom...]\n");
+}
+
+// Runs up to n instructions, continuing past draws and, like the scheduler, past unknown
+// instructions, so a ROM is timed over the same instructions the runners would run. Stops early only
+// if the program can't make progress. Sets *errored, if given, when any instruction raised an error.
+static program_run_t bench_run(program_t* program, uint64_t n, bool* errored)
+{
+	program_run_t total = { .cycles = 0, .reason = k_program_stop_budget };
+
+	while (total.cycles < n)
+	{
+		program_run_t run = program_run_cycles(program, n - total.cycles);
+		total.cycles += run.cycles;
+		total.reason = run.reason;
+
+		if (run.reason == k_program_stop_error && errored)
+			*errored = true;
+		if (run.reason == k_program_stop_key_wait || run.reason == k_program_stop_exit || run.cycles == 0)
+			break;
+	}
+
+	// Errors were skipped, so a run that got through its budget completed
+	if (total.cycles == n)
+		total.reason = k_program_stop_budget;
+
+	return total;
+}
+
+// Times the program over the configured trials and writes one result row.
+static void bench_measure(bench_t* bench, const char* kind, const char* name, program_t* program)
+{
+	static const char* reasons[] = { "ok", "draw", "key_wait", "error", "exit" };
+
+	if (bench->jit && !program_set_backend(program, k_program_backend_jit))
+	{
+		fprintf(bench->out, "%s\t%s\tjit\tunavailable\t0\t0\t0\t0\n", kind, name);
+		return;
+	}
+
+	// Warm the block cache, and find out if the program runs at all. A synthetic loop only errors
+	// on opcodes the core doesn't implement, so it isn't timed.
+	bool errored = false;
+	program_run_t run = bench_run(program, WARMUP_CYCLES, &errored);
+	if (errored && strcmp(kind, "micro") == 0)
+		run.reason = k_program_stop_error;
+
+	double sum = 0.0, sum_sq = 0.0;
+	uint64_t cycles = 0;
+	int trials = 0;
+
+	while (trials < bench->trials && run.reason == k_program_stop_budget)
+	{
+		double start = scheduler_now();
+		run = bench_run(program, bench->cycles, NULL);
+		double elapsed = scheduler_now() - start;
+
+		if (run.cycles == 0)
+			break;
+
+		double ns = elapsed * 1e9 / (double)run.cycles;
+		sum += ns;
+		sum_sq += ns * ns;
+		cycles += run.cycles;
+		trials++;
+	}
+
+	double mean = trials ? sum / trials : 0.0;
+	double variance = trials > 1 ? (sum_sq - sum * mean) / (trials - 1) : 0.0;
+	if (variance < 0.0)
+		variance = 0.0;
+
+	fprintf(bench->out, "%s\t%s\t%s\t%s\t%llu\t%.3f\t%.3f\t%.3f\n",
+		kind,
+		name,
+		bench->jit ? "jit" : "interpreter",
+		run.reason == k_program_stop_error && strcmp(kind, "micro") == 0 ? "unsupported" : reasons[run.reason],
+		(unsigned long long)cycles,
+		mean > 0.0 ? 1e3 / mean : 0.0,
+		mean,
+		sqrt(variance));
+	fflush(bench->out);
+}
+
+// Writes a row for a measurement that always completes, from the per-trial ns per operation.
+static void bench_write_row(bench_t* bench, const char* kind, const char* name, const char* backend, uint64_t ops, double sum, double sum_sq)
+{
+	double mean = sum / bench->trials;
+	double variance = bench->trials > 1 ? (sum_sq - sum * mean) / (bench->trials - 1) : 0.0;
+	if (variance < 0.0)
+		variance = 0.0;
+
+	fprintf(bench->out, "%s\t%s\t%s\tok\t%llu\t%.3f\t%.3f\t%.3f\n",
+		kind,
+		name,
+		backend,
+		(unsigned long long)ops,
+		mean > 0.0 ? 1e3 / mean : 0.0,
+		mean,
+		sqrt(variance));
+	fflush(bench->out);
+}
+
+// Times saving, and loading, the state of a program on the given platform. Loads alternate between
+// two states a few stored bytes apart, as rewinding frame by frame does. Operations stand in for
+// instructions in the row, and the platform for the backend.
+static void bench_measure_states(bench_t* bench, program_platform_t platform)
+{
+	uint8_t rom[sizeof(k_bcd)];
+	for (size_t i = 0; i < sizeof(k_bcd) / sizeof(k_bcd[0]); i++)
+	{
+		rom[i * 2] = k_bcd[i] >> 8;
+		rom[i * 2 + 1] = k_bcd[i] & 0xFF;
+	}
+
+	program_t* program = program_init_platform(NULL, platform);
+	size_t size = program ? program_state_size(program) : 0;
+	uint8_t* states = malloc(size * 2);
+	if (program == NULL || states == NULL || !program_load_rom(program, rom, sizeof(rom)))
+	{
+		free(states);
+		program_destroy(program);
+		return;
+	}
+
+	bench_run(program, WARMUP_CYCLES, NULL);
+	program_save_state(program, states, size);
+	bench_run(program, 7, NULL);
+	program_save_state(program, states + size, size);
+
+	double save_sum = 0.0, save_sum_sq = 0.0, load_sum = 0.0, load_sum_sq = 0.0;
+	for (int trial = 0; trial < bench->trials; trial++)
+	{
+		double start = scheduler_now();
+		for (int i = 0; i < STATE_OPS; i++)
+			program_save_state(program, states + size * (i & 1), size);
+		double ns = (scheduler_now() - start) * 1e9 / STATE_OPS;
+		save_sum += ns;
+		save_sum_sq += ns * ns;
+
+		start = scheduler_now();
+		for (int i = 0; i < STATE_OPS; i++)
+			program_load_state(program, states + size * (i & 1), size);
+		ns = (scheduler_now() - start) * 1e9 / STATE_OPS;
+		load_sum += ns;
+		load_sum_sq += ns * ns;
+	}
+
+	const char* name = program_platform_name(platform);
+	bench_write_row(bench, "state", "save", name, (uint64_t)STATE_OPS * bench->trials, save_sum, save_sum_sq);
+	bench_write_row(bench, "state", "load", name, (uint64_t)STATE_OPS * bench->trials, load_sum, load_sum_sq);
+
+	free(states);
+	program_destroy(program);
+}
+
+// Times the lockstep engine running the ROM on every lane. Throughput counts instructions across
+// all lanes, so it compares directly with the scalar row times the number of cores it would take.
+static void bench_measure_wide(bench_t* bench, const char* name, const uint8_t* rom, size_t size)
+{
+	wide_t* wide = wide_init_rom(rom, size, bench->lanes);
+	if (wide == NULL)
+		return;
+
+	uint64_t steps = bench->cycles / bench->lanes;
+	if (steps == 0)
+		steps = 1;
+	wide_run(wide, WARMUP_CYCLES / bench->lanes + 1);
+
+	double sum = 0.0, sum_sq = 0.0;
+	for (int trial = 0; trial < bench->trials; trial++)
+	{
+		double start = scheduler_now();
+		wide_run(wide, steps);
+		double ns = (scheduler_now() - start) * 1e9 / (double)(steps * bench->lanes);
+		sum += ns;
+		sum_sq += ns * ns;
+	}
+
+	char backend[32];
+	snprintf(backend, sizeof(backend), "lockstep_x%u", bench->lanes);
+	bench_write_row(bench, "wide", name, backend, steps * bench->lanes * bench->trials, sum, sum_sq);
+
+	wide_destroy(wide);
+}
+
+static void bench_micro(bench_t* bench, const micro_t* micro)
+{
+	uint8_t rom[256];
+	for (size_t i = 0; i < micro->length; i++)
+	{
+		rom[i * 2] = micro->code[i] >> 8;
+		rom[i * 2 + 1] = micro->code[i] & 0xFF;
+	}
+
+	program_t* program = program_init(NULL);
+	if (program && program_load_rom(program, rom, micro->length * 2))
+		bench_measure(bench, "micro", micro->name, program);
+
+	program_destroy(program);
+
+	if (bench->lanes)
+		bench_measure_wide(bench, micro->name, rom, micro->length * 2);
+}
+
+static void bench_rom(bench_t* bench, const char* path)
+{
+	program_t* program = program_init((char*)path);
+	if (program == NULL)
+	{
+		fprintf(bench->out, "rom\t%s\t%s\tload_failed\t0\t0\t0\t0\n", path, bench->jit ? "jit" : "interpreter");
+		return;
+	}
+
+	bench_measure(bench, "rom", path, program);
+	program_destroy(program);
+}
+
+int main(int argc, char** argv)
+{
+	bench_t bench = { .cycles = DEFAULT_CYCLES, .trials = DEFAULT_TRIALS, .jit = false, .lanes = DEFAULT_LANES, .out = stdout };
+	char* out_path = NULL;
+	int first_rom = argc;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--cycles") == 0 && i + 1 < argc)
+			bench.cycles = strtoull(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--trials") == 0 && i + 1 < argc)
+			bench.trials = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--jit") == 0)
+			bench.jit = true;
+		else if (strcmp(argv[i], "--lanes") == 0 && i + 1 < argc)
+			bench.lanes = (uint32_t)strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc)
+			out_path = argv[++i];
+		else if (argv[i][0] != '-')
+		{
+			first_rom = i;
+			break;
+		}
+		else
+		{
+			usage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (bench.cycles == 0 || bench.trials < 1)
+	{
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	if (out_path && (bench.out = fopen(out_path, "w")) == NULL)
+	{
+		fprintf(stderr, "Bench: couldn't open %s\n", out_path);
+		return EXIT_FAILURE;
+	}
+
+	fprintf(bench.out, "kind\tbenchmark\tbackend\tstatus\tcycles\tmips\tns_per_op\tns_stddev\n");
+
+	for (size_t i = 0; i < sizeof(k_micros) / sizeof(k_micros[0]); i++)
+		bench_micro(&bench, &k_micros[i]);
+
+	for (int platform = 0; platform < k_program_platform_count; platform++)
+		bench_measure_states(&bench, (program_platform_t)platform);
+
+	for (int i = first_rom; i < argc; i++)
+		bench_rom(&bench, argv[i]);
+
+	if (bench.out != stdout)
+		fclose(bench.out);
+
+	return EXIT_SUCCESS;
+}
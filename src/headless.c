@@ -0,0 +1,167 @@
+// Headless runner. Runs a ROM without a window and prints the final machine state.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "program.h"
+#include "scheduler.h"
+#include "replay.h"
+#include "audio.h"
+
+static void usage()
+{
+	fprintf(stderr, "Usage: vc-chip8-headless <rom|-> [--cycles <n> | --frames <n>] [--ips <n>] [--replay <file>] [--platform chip8|schip|xochip] [--jit] [--profile <file>] [--profile-folded <file>] [--wav <file>]\n");
+}
+
+static void write_profile(program_t* program, const char* path, void (*write)(const program_t*, FILE*))
+{
+	FILE* out = fopen(path, "w");
+	if (out == NULL)
+	{
+		fprintf(stderr, "Headless: couldn't open %s\n", path);
+		return;
+	}
+
+	write(program, out);
+	fclose(out);
+}
+
+int main(int argc, char** argv)
+{
+	char* rom_path = NULL;
+	uint64_t cycles = 0;
+	uint64_t frames = 0;
+	uint64_t ips = SCHEDULER_DEFAULT_IPS;
+	bool jit = false;
+	char* profile_path = NULL;
+	char* replay_path = NULL;
+	char* folded_path = NULL;
+	char* wav_path = NULL;
+	program_platform_t platform = k_program_platform_chip8;
+	bool platform_given = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--cycles") == 0 && i + 1 < argc)
+			cycles = strtoull(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+			frames = strtoull(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--ips") == 0 && i + 1 < argc)
+			ips = strtoull(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+			replay_path = argv[++i];
+		else if (strcmp(argv[i], "--platform") == 0 && i + 1 < argc)
+		{
+			if (!program_platform_from_name(argv[++i], &platform))
+			{
+				usage();
+				return EXIT_FAILURE;
+			}
+			platform_given = true;
+		}
+		else if (strcmp(argv[i], "--jit") == 0)
+			jit = true;
+		else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+			profile_path = argv[++i];
+		else if (strcmp(argv[i], "--profile-folded") == 0 && i + 1 < argc)
+			folded_path = argv[++i];
+		else if (strcmp(argv[i], "--wav") == 0 && i + 1 < argc)
+			wav_path = argv[++i];
+		else if ((argv[i][0] != '-' || strcmp(argv[i], "-") == 0) && rom_path == NULL)
+			rom_path = argv[i];
+		else
+		{
+			usage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	// A replay brings its own rate and platform, and runs to its end unless told to stop sooner
+	replay_t* replay = NULL;
+	if (replay_path)
+	{
+		replay = replay_open(replay_path);
+		if (replay == NULL)
+			return EXIT_FAILURE;
+
+		if (!platform_given)
+			platform = replay_platform(replay);
+		ips = replay_ips(replay);
+		if (frames == 0 || frames > replay_frames(replay))
+			frames = replay_frames(replay);
+		cycles = 0;
+	}
+
+	// Frames need a fixed rate to be reproducible, and sound is only produced per frame
+	if (rom_path == NULL || ips == SCHEDULER_UNLIMITED || (cycles == 0 && frames == 0) || (wav_path && frames == 0))
+	{
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	program_t* program = program_init_platform(rom_path, platform);
+	scheduler_t* scheduler = scheduler_init(ips);
+	if (program == NULL || scheduler == NULL)
+		return EXIT_FAILURE;
+
+	if (replay && !replay_matches(replay, program))
+	{
+		if (replay_platform(replay) != platform)
+			fprintf(stderr, "Headless: %s was recorded on %s\n", replay_path, program_platform_name(replay_platform(replay)));
+		else
+			fprintf(stderr, "Headless: %s was recorded with another ROM\n", replay_path);
+		return EXIT_FAILURE;
+	}
+
+	if (jit && !program_set_backend(program, k_program_backend_jit))
+		fprintf(stderr, "Headless: JIT unavailable, interpreting\n");
+
+	if (profile_path || folded_path)
+		program_set_profiling(program, true);
+
+	audio_t* audio = NULL;
+	if (wav_path)
+	{
+		audio = audio_open_wav(wav_path);
+		if (audio == NULL)
+			return EXIT_FAILURE;
+	}
+
+	program_run_t run = { .cycles = 0, .reason = k_program_stop_budget };
+	if (replay || audio)
+	{
+		for (uint32_t frame = 0; frame < frames; frame++)
+		{
+			if (replay)
+				scheduler_set_keys(scheduler, replay_keys(replay, frame));
+			program_run_t frame_run = scheduler_step_frame(scheduler, program);
+			run.cycles += frame_run.cycles;
+			run.reason = frame_run.reason;
+
+			// Offline, so every frame goes into the file rather than being dropped
+			if (audio)
+				audio_push_wait(audio, program);
+		}
+	}
+	else
+	{
+		run = scheduler_run_budget(scheduler, program, cycles, frames);
+	}
+
+	static const char* reasons[] = { "budget", "draw", "key wait", "error", "exit" };
+	printf("Cycles: %llu  Last stop: %s\n", (unsigned long long)run.cycles, reasons[run.reason]);
+	program_print_state(program, stdout);
+
+	if (profile_path)
+		write_profile(program, profile_path, program_profile_write_json);
+	if (folded_path)
+		write_profile(program, folded_path, program_profile_write_folded);
+
+	audio_close(audio);
+	replay_close(replay, 0);
+	scheduler_terminate(scheduler);
+	program_destroy(program);
+
+	return EXIT_SUCCESS;
+}
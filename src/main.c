@@ -1,25 +1,252 @@
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "program.h"
+#include "scheduler.h"
+#include "rewind.h"
+#include "replay.h"
+#include "audio.h"
+#include "audio_device.h"
+#include "pacer.h"
 #include "wm.h"
 
-int main()
+// Ten seconds of history, with a keyframe every second
+#define REWIND_FRAMES (SCHEDULER_FRAME_RATE * 10)
+#define REWIND_KEYFRAME_INTERVAL SCHEDULER_FRAME_RATE
+#define REWIND_POOL_SIZE (512 * 1024)
+#define REWIND_POOL_STATES 12	// XO-CHIP states are 64 KB; keep room for this many deltas and keyframes
+
+static void usage()
+{
+	fprintf(stderr, "Usage: vc-CHIP-8 [rom] [--ips <instructions per second>|unlimited] [--platform chip8|schip|xochip] [--record <replay>] [--wav <file>] [--pacing <margin ms>] [--palette <RRGGBB,...>] [--scanlines <0-1>] [--ghost <0-1>]\n");
+}
+
+// Fed with every frame the scheduler runs, as that frame leaves the program
+typedef struct frame_sinks_t
+{
+	audio_t* audio;
+	rewind_t* rewind;
+} frame_sinks_t;
+
+static void push_frame(const program_t* program, void* user)
+{
+	frame_sinks_t* sinks = user;
+	if (sinks->audio)
+		audio_push(sinks->audio, program);
+	if (sinks->rewind)
+		rewind_push(sinks->rewind, program);
+}
+
+// Reads up to four colours given as RRGGBB hex, separated by commas, over the start of the palette.
+static bool parse_palette(const char* text, float* palette)
+{
+	for (int i = 0; i < 4 && *text; i++)
+	{
+		unsigned int rgb;
+		int length;
+		if (sscanf(text, "%6x%n", &rgb, &length) != 1 || length != 6)
+			return false;
+
+		palette[i * 3] = ((rgb >> 16) & 0xFF) / 255.0f;
+		palette[i * 3 + 1] = ((rgb >> 8) & 0xFF) / 255.0f;
+		palette[i * 3 + 2] = (rgb & 0xFF) / 255.0f;
+
+		text += length;
+		if (*text == ',')
+			text++;
+	}
+
+	return *text == '\0';
+}
+
+int main(int argc, char** argv)
 {
+	char* rom_path = "../roms/chip8-test-suite/1-chip8-logo.ch8";
+	char* record_path = NULL;
+	char* wav_path = NULL;
+	double pacing_margin = -1.0;	// Seconds; negative runs without frame pacing
+	uint64_t ips = SCHEDULER_DEFAULT_IPS;
+	program_platform_t platform = k_program_platform_chip8;
+	float palette[12] = WM_DEFAULT_PALETTE;
+	float scanline = 0.0f, ghost = 0.0f;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--ips") == 0 && i + 1 < argc)
+		{
+			i++;
+			ips = strcmp(argv[i], "unlimited") == 0 ? SCHEDULER_UNLIMITED : strtoull(argv[i], NULL, 10);
+		}
+		else if (strcmp(argv[i], "--platform") == 0 && i + 1 < argc)
+		{
+			if (!program_platform_from_name(argv[++i], &platform))
+			{
+				usage();
+				return EXIT_FAILURE;
+			}
+		}
+		else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+		{
+			record_path = argv[++i];
+		}
+		else if (strcmp(argv[i], "--wav") == 0 && i + 1 < argc)
+		{
+			wav_path = argv[++i];
+		}
+		else if (strcmp(argv[i], "--pacing") == 0 && i + 1 < argc)
+		{
+			pacing_margin = strtod(argv[++i], NULL) / 1000.0;
+		}
+		else if (strcmp(argv[i], "--palette") == 0 && i + 1 < argc)
+		{
+			if (!parse_palette(argv[++i], palette))
+			{
+				fprintf(stderr, "Bad palette %s, using the default\n", argv[i]);
+				memcpy(palette, (const float[12])WM_DEFAULT_PALETTE, sizeof(palette));
+			}
+		}
+		else if (strcmp(argv[i], "--scanlines") == 0 && i + 1 < argc)
+		{
+			scanline = (float)strtod(argv[++i], NULL);
+		}
+		else if (strcmp(argv[i], "--ghost") == 0 && i + 1 < argc)
+		{
+			ghost = (float)strtod(argv[++i], NULL);
+		}
+		else if (argv[i][0] == '-')
+		{
+			usage();
+			return EXIT_FAILURE;
+		}
+		else
+		{
+			rom_path = argv[i];
+		}
+	}
+
 	wm_t* wm = wm_init();
-	program_t* program = program_init("../roms/chip8-test-suite/1-chip8-logo.ch8");
-	//wm_init_texture(wm, NULL, 32, 64);
+	program_t* program = program_init_platform(rom_path, platform);
+	scheduler_t* scheduler = scheduler_init(ips);
 
-	if(wm == NULL)
+	if(wm == NULL || program == NULL || scheduler == NULL)
 		return EXIT_FAILURE;
 
+	wm_set_palette(wm, palette);
+	wm_set_effects(wm, scanline, ghost);
+
+	// A replay has to cover every frame in order, so recording and rewinding don't mix
+	replay_t* replay = NULL;
+	rewind_t* rewind = NULL;
+
+	// Sound goes to the audio thread, which plays it, or writes it to a file with --wav. A late audio
+	// thread costs frames of sound, never emulation time, and without a device the program runs silent.
+	audio_t* audio = NULL;
+	if (wav_path)
+	{
+		audio = audio_open_wav(wav_path);
+		if (audio == NULL)
+			return EXIT_FAILURE;
+	}
+	else
+	{
+		audio = audio_open_device();
+	}
+
+	// Frame pacing runs each frame just before the vblank it's shown at, rather than right after the
+	// previous one, cutting a refresh from the time between a key press and its result on screen
+	pacer_t* pacer = NULL;
+	if (pacing_margin >= 0.0)
+	{
+		pacer = pacer_init(1.0 / wm_refresh_rate(wm), pacing_margin);
+		if (pacer == NULL)
+			return EXIT_FAILURE;
+	}
+
+	if (record_path)
+	{
+		replay = replay_record(record_path, ips, program);
+		if (replay == NULL)
+			return EXIT_FAILURE;
+		scheduler_record(scheduler, replay);
+	}
+	else
+	{
+		size_t pool = program_state_size(program) * REWIND_POOL_STATES;
+		rewind = rewind_init(program, REWIND_FRAMES, REWIND_KEYFRAME_INTERVAL, pool > REWIND_POOL_SIZE ? pool : REWIND_POOL_SIZE);
+	}
+
+	// Every frame goes to the audio thread and the rewind history, even when an update runs several
+	frame_sinks_t sinks = { .audio = audio, .rewind = rewind };
+	scheduler_on_frame(scheduler, push_frame, &sinks);
+
+	// The CPU and timers follow the monotonic clock; rendering just presents whatever state the
+	// last frames left behind, at whatever rate the display allows.
 	while(!wm_should_close(wm))
 	{
-		program_update(program);
-		//wm_init_texture(wm, program_display_to_rgb(program), 32, 64);
-		wm_update(wm);
+		// A program suspended in FX0A needs nothing until the next key event, so sleep until then
+		if (scheduler_suspended(scheduler) && !(wm_key_mask(wm) & k_key_rewind))
+			wm_wait_events(wm);
+
+		// Paced frames read input late, and emulate up to the vblank they'll be shown at
+		double target = 0.0;
+		if (pacer)
+		{
+			target = pacer_wait(pacer);
+			wm_poll_events(wm);
+		}
+
+		// Holding the rewind key plays history backwards, one frame per redraw
+		bool new_frame;
+		if (rewind && (wm_key_mask(wm) & k_key_rewind))
+		{
+			new_frame = rewind_step_back(rewind, program);
+		}
+		else
+		{
+			// Keys are applied, and recorded, at the start of each frame the scheduler runs
+			scheduler_set_keys(scheduler, wm_keypad(wm));
+
+			new_frame = scheduler_update(scheduler, program, pacer ? target : scheduler_now()) > 0;
+		}
+
+		// Redraws between frames show the same texture
+		if (new_frame)
+		{
+			uint32_t width, height;
+			program_display_size(program, &width, &height);
+			wm_update_texture(wm, program_display_rows(program), program_display_take_dirty(program), program_display_planes(program), width, height);
+		}
+
+		if (pacer)
+		{
+			wm_draw(wm);
+			double ready = scheduler_now();
+			wm_swap(wm);
+			pacer_presented(pacer, ready, scheduler_now());
+
+			pacer_stats_t stats;
+			if (pacer_take_stats(pacer, &stats))
+			{
+				char text[64];
+				snprintf(text, sizeof(text), "latency %.1f avg %.1f max  work %.1f ms  missed %u",
+					stats.latency_avg * 1000.0, stats.latency_max * 1000.0, stats.work * 1000.0, stats.missed);
+				wm_set_overlay(wm, text);
+			}
+		}
+		else
+		{
+			wm_update(wm);
+		}
 	}
 
+	audio_close(audio);
+	pacer_terminate(pacer);
+	replay_close(replay, scheduler_frame(scheduler));
+	rewind_terminate(rewind);
+	scheduler_terminate(scheduler);
+	program_destroy(program);
 	wm_terminate(wm);
 
 	return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
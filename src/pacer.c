@@ -0,0 +1,119 @@
+// Frame pacing
+// Predicts the next vblank from the last completed swap and wakes up the measured work time plus
+// a safety margin before it.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pacer.h"
+#include "scheduler.h"
+#include "thread.h"
+
+// The last stretch before waking is spun rather than slept, as sleeps overshoot by about this much
+#define PACER_SPIN_SECONDS 0.001
+
+// How fast the work estimate falls back after a slow frame. It rises at once, so a single spike
+// pushes wake-ups earlier and they drift later again over about a hundred frames.
+#define PACER_WORK_DECAY 0.01
+
+typedef struct pacer_t
+{
+	double period;		 // Seconds between vblanks
+	double margin;		 // Seconds kept free on top of the work estimate
+	double work;		 // Estimated seconds from waking until the frame is ready to swap
+	double next_vblank;	 // Predicted time of the vblank the current frame is aimed at
+	double wake;		 // When the current frame woke up
+	bool synced;		 // A swap has been seen, so next_vblank means something
+
+	// Statistics since stats_start
+	double stats_start;
+	double latency_sum, latency_max;
+	uint32_t frames, missed;
+} pacer_t;
+
+pacer_t* pacer_init(double refresh_period, double margin)
+{
+	pacer_t* pacer = calloc(1, sizeof(pacer_t));
+	if (pacer == NULL)
+	{
+		fprintf(stderr, "Pacer: failed to allocate memory for object\n");
+		return NULL;
+	}
+
+	pacer->period = refresh_period;
+	pacer->margin = margin;
+	pacer->work = refresh_period / 4;
+	pacer->stats_start = scheduler_now();
+
+	return pacer;
+}
+
+void pacer_terminate(pacer_t* pacer)
+{
+	free(pacer);
+}
+
+double pacer_wait(pacer_t* pacer)
+{
+	double now = scheduler_now();
+
+	// Without a swap to go by (or after blocking for input), aim at a vblank one period out
+	if (!pacer->synced || pacer->next_vblank < now)
+		pacer->next_vblank = now + pacer->period;
+
+	double wake = pacer->next_vblank - pacer->work - pacer->margin;
+	if (wake - now > PACER_SPIN_SECONDS)
+	{
+		thread_sleep(wake - now - PACER_SPIN_SECONDS);
+	}
+
+	while ((now = scheduler_now()) < wake)
+		;
+
+	pacer->wake = now;
+	return pacer->next_vblank;
+}
+
+void pacer_presented(pacer_t* pacer, double ready, double presented)
+{
+	double work = ready - pacer->wake;
+	if (work > pacer->work)
+		pacer->work = work;
+	else
+		pacer->work += (work - pacer->work) * PACER_WORK_DECAY;
+
+	// A swap that completed well after the vblank it was aimed at waited for the one after
+	if (pacer->synced && presented > pacer->next_vblank + pacer->period / 2)
+		pacer->missed++;
+
+	double latency = presented - pacer->wake;
+	pacer->latency_sum += latency;
+	if (latency > pacer->latency_max)
+		pacer->latency_max = latency;
+	pacer->frames++;
+
+	// The swap returns at the vblank, so the next one is a period later
+	pacer->next_vblank = presented + pacer->period;
+	pacer->synced = true;
+}
+
+bool pacer_take_stats(pacer_t* pacer, pacer_stats_t* stats)
+{
+	double now = scheduler_now();
+	if (now - pacer->stats_start < 1.0 || pacer->frames == 0)
+		return false;
+
+	stats->latency_avg = pacer->latency_sum / pacer->frames;
+	stats->latency_max = pacer->latency_max;
+	stats->work = pacer->work;
+	stats->frames = pacer->frames;
+	stats->missed = pacer->missed;
+
+	pacer->stats_start = now;
+	pacer->latency_sum = 0.0;
+	pacer->latency_max = 0.0;
+	pacer->frames = 0;
+	pacer->missed = 0;
+
+	return true;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+// Frame pacing. Instead of emulating right after a swap and then waiting a whole refresh for the
+// next one, sleeps until just before the predicted vblank, so that input is read, the frame is run
+// and the picture is swapped as late as possible. The time this takes is measured on every frame.
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct pacer_t pacer_t;
+
+// Latency over the last second: from reading input to the swap that shows its result
+typedef struct pacer_stats_t
+{
+	double latency_avg;	// Seconds
+	double latency_max;	// Seconds
+	double work;		// Current estimate of the time from waking until the frame is ready to swap, in seconds
+	uint32_t frames;
+	uint32_t missed;	// Frames that woke too late and were shown a refresh later
+} pacer_stats_t;
+
+// Creates a pacer for a display refreshing every refresh_period seconds. margin is extra time, in
+// seconds, kept free before the vblank on top of the measured work.
+pacer_t* pacer_init(double refresh_period, double margin);
+
+void pacer_terminate(pacer_t* pacer);
+
+// Sleeps until the latest time the frame can start and still make the next vblank, and returns the
+// time of that vblank. Read input right after this returns.
+double pacer_wait(pacer_t* pacer);
+
+// Call as soon as the swap has completed. ready is when the frame was drawn and about to be swapped,
+// presented the current time: that's the vblank the frame was shown at. Only the time up to ready
+// counts as work; the rest was spent waiting for the vblank.
+void pacer_presented(pacer_t* pacer, double ready, double presented);
+
+// Fills in the statistics and starts a new period, once a second has passed since the last call.
+// Returns false, leaving stats alone, before that.
+bool pacer_take_stats(pacer_t* pacer, pacer_stats_t* stats);
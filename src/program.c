@@ -1,84 +1,90 @@
 // Program Manager
 // Handles CHIP-8 Logic.
 
+#ifndef _WIN32
+#define _DEFAULT_SOURCE
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
+#include <errno.h>
 
-//#define WIN32_LEAN_AND_MEAN
-#ifdef WIN32_LEAN_AND_MEAN
+#include "program.h"
+#include "program_internal.h"
+#include "program_jit.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #endif
 
-// Built-in font
-typedef struct program_t
-{
-	uint8_t* memory;	  // 4kB of memory (all RAM, entire program is loaded in at startup)
-	bool display[32][64]; // 32 x 64 px display ("on/off" values)
-	uint16_t pc;		  // 16-bit program counter
-	uint16_t index;		  // 16-bit register for mem locations	
-	uint16_t* func_stack; // 16-bit function stack
-	uint8_t delay_timer;  // Decrements every frame (60fps) (independent of fetch/decode/exec loop)
-	uint8_t sound_timer;  // Behaves like delay timer but beeps while above 0
-	uint8_t vars[16];	  // Labeled V0 through VF
-	bool prog_loaded;     // Indicates whether or not a program is actually loaded
-} program_t;
+#define PROGRAM_ROM_START 0x200
+#define PROGRAM_ROM_MAX(program) ((program)->memory_size - PROGRAM_ROM_START)
 
-// Asks the system for the given file and writes the data to program memory.
-bool program_open_rom_to_mem(char* file_path, void** ram)
-{
-#ifdef WIN32_LEAN_AND_MEAN
-	HANDLE program_file;
-	if (file_path)
-	{
-		wchar_t wide_path[1024];
-		if (MultiByteToWideChar(CP_UTF8, 0, file_path, -1, wide_path, sizeof(wide_path)) <= 0)
-		{
-			fprintf(stderr, "PROGRAM: File read failed, failure parsing file path\n");
-			return false;
-		}
-		program_file = CreateFile(wide_path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-		if (program_file == INVALID_HANDLE_VALUE)
-		{
-			char* error;
-			switch (GetLastError())
-			{
-				case ERROR_FILE_NOT_FOUND:
-					error = "couldn't find file at given path";
-					break;
-				default:
-					error = "undefined error";
-					break;
-			}
+// Until F002 loads a pattern, the sound is a square wave of four samples on and four off: a 500 Hz
+// beep at the default pitch of 4000 samples per second
+#define PROGRAM_DEFAULT_PITCH 64
+#define PROGRAM_DEFAULT_PATTERN 0xF0
 
-			fprintf(stderr, "PROGRAM: file read failed: %s\n", error);
-		}
-	}
-	else
-	{
-		fprintf(stderr, "Program: failed to initialize, file path is NULL");
-		return false;
-	}
+// Everything a program owns lives in one allocation, each part starting on its own cache line
+#define PROGRAM_ALIGN(size) (((size) + PROGRAM_CACHE_LINE - 1) & ~(size_t)(PROGRAM_CACHE_LINE - 1))
+#define PROGRAM_RGB_SIZE (sizeof(float) * PROGRAM_DISPLAY_WORDS * 64 * PROGRAM_DISPLAY_ROWS * 3)
 
-	PLARGE_INTEGER file_size = 0;
-	GetFileSizeEx(program_file, &file_size);
+// Offsets of the parts of a program's arena. The parts indexed by address are sized by the platform.
+typedef struct program_arena_t
+{
+	size_t blocks, entries, code_map, rgb, memory, size;
+} program_arena_t;
 
-	
-	//program->memory + 0x200
-	if (!ReadFile(program_file, ram, file_size, NULL, NULL))
-	{
-		//fprintf(stderr, "Program: file read failed: %s\n", error);
-	}
+static program_arena_t program_arena_layout(uint32_t memory_size)
+{
+	program_arena_t arena;
+	arena.memory = PROGRAM_ARENA_MEMORY;
+	arena.blocks = arena.memory + PROGRAM_ALIGN(memory_size);
+	arena.entries = arena.blocks + PROGRAM_ALIGN(sizeof(program_block_cache_t));
+	arena.code_map = arena.entries + PROGRAM_ALIGN(sizeof(program_block_entry_t) * memory_size);
+	arena.rgb = arena.code_map + PROGRAM_ALIGN(memory_size / 8);
+	arena.size = arena.rgb + PROGRAM_ALIGN(PROGRAM_RGB_SIZE);
+	return arena;
+}
+
+static void* program_arena_alloc(size_t size)
+{
+#ifdef _WIN32
+	void* arena = _aligned_malloc(size, PROGRAM_CACHE_LINE);
+#else
+	void* arena = aligned_alloc(PROGRAM_CACHE_LINE, size);
 #endif
+	if (arena)
+		memset(arena, 0, size);
+	return arena;
+}
 
-	// Return false on read failure
-	return false;
+static void program_arena_free(void* arena)
+{
+#ifdef _WIN32
+	_aligned_free(arena);
+#else
+	free(arena);
+#endif
 }
 
-// Opens program file and intializes CHIP-8 program.
+// Opens program file and intializes CHIP-8 program. Pass NULL to start without a ROM.
 program_t* program_init(char* file_path)
+{
+	return program_init_platform(file_path, k_program_platform_chip8);
+}
+
+// Opens program file and intializes a program for the given platform.
+program_t* program_init_platform(char* file_path, program_platform_t platform)
 {
 	uint8_t font[] =
 	{
@@ -100,113 +106,435 @@ program_t* program_init(char* file_path)
 		0xF0, 0x80, 0xF0, 0x80, 0x80,
 	};
 
-	program_t* program = malloc(sizeof(program_t));
-	if(program == NULL)
+	// SUPER-CHIP 8 x 10 digits
+	uint8_t big_font[] =
+	{
+		0x3C, 0x7E, 0xE7, 0xC3, 0xC3, 0xC3, 0xC3, 0xE7, 0x7E, 0x3C,
+		0x18, 0x38, 0x58, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x3C,
+		0x3E, 0x7F, 0xC3, 0x06, 0x0C, 0x18, 0x30, 0x60, 0xFF, 0xFF,
+		0x3C, 0x7E, 0xC3, 0x03, 0x0E, 0x0E, 0x03, 0xC3, 0x7E, 0x3C,
+		0x06, 0x0E, 0x1E, 0x36, 0x66, 0xC6, 0xFF, 0xFF, 0x06, 0x06,
+		0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFE, 0x03, 0xC3, 0x7E, 0x3C,
+		0x3E, 0x7C, 0xE0, 0xC0, 0xFC, 0xFE, 0xC3, 0xC3, 0x7E, 0x3C,
+		0xFF, 0xFF, 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x60, 0x60,
+		0x3C, 0x7E, 0xC3, 0xC3, 0x7E, 0x7E, 0xC3, 0xC3, 0x7E, 0x3C,
+		0x3C, 0x7E, 0xC3, 0xC3, 0x7F, 0x3F, 0x03, 0x03, 0x3E, 0x7C,
+		0x18, 0x3C, 0x66, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3,
+		0xFC, 0xFE, 0xC3, 0xC3, 0xFE, 0xFE, 0xC3, 0xC3, 0xFE, 0xFC,
+		0x3C, 0x7E, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0x7E, 0x3C,
+		0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC,
+		0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFC, 0xC0, 0xC0, 0xFF, 0xFF,
+		0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFC, 0xC0, 0xC0, 0xC0, 0xC0,
+	};
+
+	program_decode_init();
+
+	if (platform >= k_program_platform_count)
+		platform = k_program_platform_chip8;
+
+	// One zeroed allocation holds the program, its block cache, the RGB scratch buffer and RAM
+	uint32_t memory_size = program_platform_memory_size(platform);
+	program_arena_t layout = program_arena_layout(memory_size);
+	uint8_t* arena = program_arena_alloc(layout.size);
+	if(arena == NULL)
 	{
 		fprintf(stderr, "Program: failed to allocate memory for object\n");
 		return NULL;
 	}
 
-	program->memory = malloc(sizeof(uint8_t) * 4096);
+	program_t* program = (program_t*)arena;
+	program->blocks = (program_block_cache_t*)(arena + layout.blocks);
+	program->blocks->entries = (program_block_entry_t*)(arena + layout.entries);
+	program->blocks->code_map = arena + layout.code_map;
+	program->rgb = (float*)(arena + layout.rgb);
+	program->memory = arena + layout.memory;
+	program->memory_size = memory_size;
+	program->jit = NULL;
+	program->events = 0;
+	program->prog_loaded = false;
+	program->rom_hash = 0;
+	program->platform = (uint8_t)platform;
+	program->handlers = program_platform_handlers(platform);
+	program->planes = 1;
+	program->rng = 0x2545F491;
+	program->pitch = PROGRAM_DEFAULT_PITCH;
+	memset(program->pattern, PROGRAM_DEFAULT_PATTERN, sizeof(program->pattern));
+	program->dirty_rows = ~0ULL;
 
 	for (int i = 0; i < 32; i++)
+		program->display[0][i][0] = i % 2 == 0 ? ~0ULL : 0;
+#ifdef WIN32_LEAN_AND_MEAN
+	memcpy_s(program->memory + PROGRAM_FONT_ADDR, sizeof(uint8_t) * (memory_size - PROGRAM_FONT_ADDR), font, sizeof(font));
+#endif
+	memcpy(program->memory + PROGRAM_FONT_ADDR, font, sizeof(font));
+	memcpy(program->memory + PROGRAM_BIG_FONT_ADDR, big_font, sizeof(big_font));
+	
+	program->pc = PROGRAM_ROM_START;
+	program->delay_timer = 0;
+	program->sound_timer = 0;
+
+	if (file_path)
 	{
-		for (int j = 0; j < 64; j++)
+		program_load_error_t error = program_load_file(program, file_path);
+		if (error != k_program_load_ok)
 		{
-			if (i % 2 == 0)
-				program->display[i][j] = true;
-			else
-				program->display[i][j] = false;
-
+			fprintf(stderr, "Program: couldn't load %s: %s\n", file_path, program_load_error_string(error));
+			program_destroy(program);
+			return NULL;
 		}
 	}
-#ifdef WIN32_LEAN_AND_MEAN
-	memcpy_s(program->memory + 0x050, sizeof(uint8_t) * (4096 - 0x050), font, sizeof(font));
-#endif
-	memcpy(program->memory + 0x050, font, sizeof(font));
-	
-	program->pc = 0x200;
 
 	return program;
 }
 
-// Takes the local/absolute path of a file and a location in memory to read the file into.
-// Writes the content of the file to the given location in memory.
-// Returns the number of bytes read before EOF.
-// If the read operation fails, the program will return a negative int.
-int program_open_file(char* file_path, void* out_mem, int max_length)
+// Frees the program and everything it owns.
+void program_destroy(program_t* program)
 {
-#ifdef WIN32_LEAN_AND_MEAN
-	HANDLE program_file;
-	if (file_path)
+	if (program == NULL)
+		return;
+
+	// The JIT's executable memory and the optional profile are the only separate allocations
+	program_jit_terminate(program->jit);
+	free(program->profile);
+	program_arena_free(program);
+}
+
+// Finishes loading a ROM of the given size that's already in memory.
+static void program_rom_loaded(program_t* program, size_t size)
+{
+	program_invalidate(program, PROGRAM_ROM_START, (uint16_t)size);
+	program->pc = PROGRAM_ROM_START;
+	program->key_wait = false;
+	program->prog_loaded = true;
+
+	// FNV-1a, like the display hash
+	program->rom_hash = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < size; i++)
+	{
+		program->rom_hash ^= program->memory[PROGRAM_ROM_START + i];
+		program->rom_hash *= 0x100000001b3ULL;
+	}
+}
+
+// Copies a ROM image into memory at 0x200 and marks the program as loaded.
+bool program_load_rom(program_t* program, const uint8_t* rom, size_t size)
+{
+	if (size > PROGRAM_ROM_MAX(program))
+	{
+		fprintf(stderr, "Program: ROM is too large (%zu bytes)\n", size);
+		return false;
+	}
+
+	memcpy(program->memory + PROGRAM_ROM_START, rom, size);
+	program_rom_loaded(program, size);
+
+	return true;
+}
+
+// Reads a stream of unknown length straight into memory. One extra byte is requested past the
+// limit so oversized input can be told apart from input that fits exactly.
+static program_load_error_t program_load_stream(program_t* program, FILE* stream)
+{
+	uint8_t* dest = program->memory + PROGRAM_ROM_START;
+	size_t size = fread(dest, 1, PROGRAM_ROM_MAX(program), stream);
+
+	if (ferror(stream))
+		return k_program_load_read_failed;
+	if (size == 0)
+		return k_program_load_empty;
+
+	uint8_t extra;
+	if (size == PROGRAM_ROM_MAX(program) && fread(&extra, 1, 1, stream) == 1)
+		return k_program_load_too_large;
+
+	program_rom_loaded(program, size);
+	return k_program_load_ok;
+}
+
+#ifdef _WIN32
+
+static program_load_error_t program_load_path(program_t* program, const char* file_path)
+{
+	wchar_t wide_path[1024];
+	if (MultiByteToWideChar(CP_UTF8, 0, file_path, -1, wide_path, sizeof(wide_path) / sizeof(wide_path[0])) <= 0)
+		return k_program_load_not_found;
+
+	HANDLE file = CreateFileW(wide_path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
 	{
-		wchar_t wide_path[1024];
-		if (MultiByteToWideChar(CP_UTF8, 0, file_path, -1, wide_path, sizeof(wide_path)) <= 0)
+		switch (GetLastError())
 		{
-			fprintf(stderr, "wah\n");
-			return NULL;
+			case ERROR_FILE_NOT_FOUND:
+			case ERROR_PATH_NOT_FOUND:
+				return k_program_load_not_found;
+			case ERROR_ACCESS_DENIED:
+				return k_program_load_access_denied;
+			default:
+				return k_program_load_read_failed;
 		}
-		program_file = CreateFile(wide_path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-		if (program_file == INVALID_HANDLE_VALUE)
-		{
-			char* error;
-			switch (GetLastError())
-			{
-				case ERROR_FILE_NOT_FOUND:
-					error = "couldn't find file at given path";
-					break;
-				default:
-					error = "undefined error";
-					break;
-			}
+	}
+
+	program_load_error_t error = k_program_load_ok;
+	uint8_t* dest = program->memory + PROGRAM_ROM_START;
+
+	if (GetFileType(file) != FILE_TYPE_DISK)
+	{
+		// Pipes have no size up front
+		DWORD size = 0, read = 0;
+		while (size < PROGRAM_ROM_MAX(program) && ReadFile(file, dest + size, PROGRAM_ROM_MAX(program) - size, &read, NULL) && read > 0)
+			size += read;
+
+		uint8_t extra;
+		if (size == 0)
+			error = k_program_load_empty;
+		else if (size == PROGRAM_ROM_MAX(program) && ReadFile(file, &extra, 1, &read, NULL) && read == 1)
+			error = k_program_load_too_large;
+		else
+			program_rom_loaded(program, size);
+
+		CloseHandle(file);
+		return error;
+	}
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size))
+		error = k_program_load_read_failed;
+	else if (file_size.QuadPart == 0)
+		error = k_program_load_empty;
+	else if (file_size.QuadPart > PROGRAM_ROM_MAX(program))
+		error = k_program_load_too_large;
+
+	if (error == k_program_load_ok)
+	{
+		HANDLE mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		const void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
 
-			fprintf(stderr, "Program: file read failed: %s\n", error);
+		if (view)
+		{
+			memcpy(dest, view, (size_t)file_size.QuadPart);
+			program_rom_loaded(program, (size_t)file_size.QuadPart);
+			UnmapViewOfFile(view);
+		}
+		else
+		{
+			error = k_program_load_read_failed;
 		}
+
+		if (mapping)
+			CloseHandle(mapping);
 	}
-	else
+
+	CloseHandle(file);
+	return error;
+}
+
+#else
+
+static program_load_error_t program_load_path(program_t* program, const char* file_path)
+{
+	int fd = open(file_path, O_RDONLY);
+	if (fd < 0)
+		return errno == EACCES ? k_program_load_access_denied : k_program_load_not_found;
+
+	struct stat info;
+	if (fstat(fd, &info) != 0)
 	{
-		fprintf(stderr, "Program: failed to initialize, file path is NULL");
-		return NULL;
+		close(fd);
+		return k_program_load_read_failed;
 	}
 
-	PLARGE_INTEGER file_size = 0;
-	GetFileSizeEx(program_file, &file_size);
+	program_load_error_t error = k_program_load_ok;
+	uint8_t* dest = program->memory + PROGRAM_ROM_START;
 
-	if (!ReadFile(program_file, (program->memory + 0x200), file_size, NULL, NULL))
+	if (!S_ISREG(info.st_mode))
+	{
+		// Pipes, FIFOs and character devices have no size up front
+		size_t size = 0;
+		ssize_t got;
+		while (size < PROGRAM_ROM_MAX(program) && (got = read(fd, dest + size, PROGRAM_ROM_MAX(program) - size)) > 0)
+			size += (size_t)got;
+
+		uint8_t extra;
+		if (size == 0)
+			error = k_program_load_empty;
+		else if (size == PROGRAM_ROM_MAX(program) && read(fd, &extra, 1) == 1)
+			error = k_program_load_too_large;
+		else
+			program_rom_loaded(program, size);
+	}
+	else if (info.st_size == 0)
+	{
+		error = k_program_load_empty;
+	}
+	else if (info.st_size > PROGRAM_ROM_MAX(program))
+	{
+		error = k_program_load_too_large;
+	}
+	else
 	{
-		//fprintf(stderr, "Program: file read failed: %s\n", error);
+		void* view = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (view != MAP_FAILED)
+		{
+			memcpy(dest, view, (size_t)info.st_size);
+			program_rom_loaded(program, (size_t)info.st_size);
+			munmap(view, (size_t)info.st_size);
+		}
+		else
+		{
+			error = k_program_load_read_failed;
+		}
 	}
+
+	close(fd);
+	return error;
+}
+
 #endif
-	return -1;
+
+// Loads a ROM into memory at 0x200. Regular files are mapped read-only and copied in directly;
+// pipes and "-" (standard input) are streamed into memory.
+program_load_error_t program_load_file(program_t* program, const char* file_path)
+{
+	if (file_path == NULL)
+		return k_program_load_no_path;
+
+	if (strcmp(file_path, "-") == 0)
+		return program_load_stream(program, stdin);
+
+	return program_load_path(program, file_path);
 }
 
-// Returns an array of floats representing the current state of the display.
-float* program_display_to_rgb(program_t* program)
+const char* program_load_error_string(program_load_error_t error)
 {
-	float* ret = malloc(sizeof(float) * 64 * 32 * 3);
-	if (ret == NULL)
+	switch (error)
 	{
-		fprintf(stderr, "Program: failed to make RGB data\n");
-		return NULL;
+		case k_program_load_ok:
+			return "success";
+		case k_program_load_no_path:
+			return "file path is NULL";
+		case k_program_load_not_found:
+			return "couldn't find file at given path";
+		case k_program_load_access_denied:
+			return "access denied";
+		case k_program_load_read_failed:
+			return "read failed";
+		case k_program_load_empty:
+			return "file is empty";
+		case k_program_load_too_large:
+			return "file doesn't fit in memory";
+		default:
+			return "undefined error";
 	}
+}
 
-	int pos = 0;
-	for (int i = 0; i < 32; i++)
+// Returns the packed display: PROGRAM_DISPLAY_PLANES planes of PROGRAM_DISPLAY_ROWS rows, each
+// PROGRAM_DISPLAY_WORDS 64-bit words, leftmost pixel in the high bit of the first.
+const uint64_t* program_display_rows(const program_t* program)
+{
+	return program->display[0][0];
+}
+
+uint32_t program_display_planes(const program_t* program)
+{
+	return program->platform == k_program_platform_xochip ? 2 : 1;
+}
+
+// Size of the display in the current mode, in pixels.
+void program_display_size(const program_t* program, uint32_t* width, uint32_t* height)
+{
+	*width = program->hires ? 128 : 64;
+	*height = program->hires ? 64 : 32;
+}
+
+// Colour index of pixel x of a row: its bit in each plane the platform draws to.
+static int program_display_color(const program_t* program, uint32_t row, uint32_t x)
+{
+	int color = 0;
+	for (uint32_t p = 0; p < program_display_planes(program); p++)
+		color |= (int)PROGRAM_PIXEL(program->display[p][row][x / 64], x % 64) << p;
+	return color;
+}
+
+// Returns the mask of display rows changed since the last call, and clears it.
+uint64_t program_display_take_dirty(program_t* program)
+{
+	uint64_t dirty = program->dirty_rows;
+	program->dirty_rows = 0;
+	return dirty;
+}
+
+// FNV-1a over the display, one byte per 8 pixels, rows top to bottom, leftmost pixel in the
+// high bit, then the same for the second plane on XO-CHIP. Only the pixels of the current mode are
+// hashed, and independently of how the display is stored, so hashes stay comparable across builds.
+uint64_t program_display_hash(const program_t* program)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	uint32_t width, height;
+	program_display_size(program, &width, &height);
+
+	for (uint32_t p = 0; p < program_display_planes(program); p++)
 	{
-		for (int j = 0; j < 64; j++)
+		for (uint32_t i = 0; i < height; i++)
 		{
-			if (program->display[i][j])
-			{
-				*(ret + pos) = 1.0f;
-				*(ret + pos + 1) = 1.0f;
-				*(ret + pos + 2) = 1.0f;
-			}
-			else
+			for (uint32_t w = 0; w < width / 64; w++)
 			{
-				*(ret + pos) = 0.0f;
-				*(ret + pos + 1) = 0.0f;
-				*(ret + pos + 2) = 0.0f;
+				for (int j = 56; j >= 0; j -= 8)
+				{
+					hash ^= (uint8_t)(program->display[p][i][w] >> j);
+					hash *= 0x100000001b3ULL;
+				}
 			}
+		}
+	}
+
+	return hash;
+}
+
+uint64_t program_rom_hash(const program_t* program)
+{
+	return program->rom_hash;
+}
+
+// Writes the registers, the display and its hash in a human-readable form.
+void program_print_state(const program_t* program, FILE* out)
+{
+	uint32_t width, height;
+	program_display_size(program, &width, &height);
+
+	fprintf(out, "PC: %03X  I: %03X  DT: %02X  ST: %02X\n", program->pc, program->index, program->delay_timer, program->sound_timer);
+
+	for (int i = 0; i < 16; i++)
+		fprintf(out, "V%X: %02X%s", i, program->vars[i], i % 8 == 7 ? "\n" : "  ");
+
+	for (uint32_t i = 0; i < height; i++)
+	{
+		for (uint32_t j = 0; j < width; j++)
+			fputc(".#+@"[program_display_color(program, i, j)], out);
+		fputc('\n', out);
+	}
+
+	fprintf(out, "Display hash: %016llx\n", (unsigned long long)program_display_hash(program));
+}
+
+// Returns an array of floats representing the current state of the display, row by row at the
+// current size, with the four XO-CHIP colours as shades of grey. The array belongs to the program
+// and is overwritten by the next call.
+float* program_display_to_rgb(program_t* program)
+{
+	static const float shades[4] = { 0.0f, 1.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+	float* ret = program->rgb;
+	uint32_t width, height;
+	program_display_size(program, &width, &height);
+
+	int pos = 0;
+	for (uint32_t i = 0; i < height; i++)
+	{
+		for (uint32_t j = 0; j < width; j++)
+		{
+			float shade = shades[program_display_color(program, i, j)];
+			*(ret + pos) = shade;
+			*(ret + pos + 1) = shade;
+			*(ret + pos + 2) = shade;
 			pos += 3;
 		}
 	}
@@ -214,90 +542,311 @@ float* program_display_to_rgb(program_t* program)
 	return ret;
 }
 
-void program_update(program_t* program)
+// Drops every cached block along with any native translations of them.
+static void program_blocks_flush(program_t* program)
 {
-	// TODO: timing w/ user-definable speed
+	program_block_cache_t* cache = program->blocks;
 
-	// Make sure there's actually a program running
-	if (!program->prog_loaded)
-		return;
+	memset(cache->entries, 0, sizeof(program_block_entry_t) * program->memory_size);
+	memset(cache->code_map, 0, program->memory_size / 8);
+	cache->pool_used = 0;
 
-	// Fetch
-	uint16_t instruction = *(program->memory + program->pc) << 8;
-	instruction += *(program->memory + program->pc + 1);
-	program->pc += 2;
+	if (program->jit)
+		program_jit_flush(program->jit);
+}
 
-	//printf("current instruction: %x\n", instruction);
+// Must be called after anything writes to program memory. Drops the cached blocks if any of them
+// were decoded from the written bytes.
+void program_invalidate(program_t* program, uint16_t addr, uint32_t len)
+{
+	program_block_cache_t* cache = program->blocks;
 
-	// Decode / Execute
-	switch (instruction & 0xF000)
+	for (uint32_t i = 0; i < len; i++)
 	{
-	case 0x0000:
-		if (instruction == 0x00E0) // Clear screen
+		uint16_t byte = (addr + i) & (program->memory_size - 1);
+		if (cache->code_map[byte >> 3] & (1 << (byte & 7)))
 		{
-			for (int i = 0; i < 32; i++)
-			{
-				for (int j = 0; j < 64; j++)
-					program->display[i][j] = false;
-			}
+			program_blocks_flush(program);
+			return;
 		}
-		break;
-	case 0x1000: // 1NNN - jump to 0xNNN
-		program->pc = instruction ^ 0x1000;
-		break;
-	case 0x6000: // 6XNN - set register VX to NN
-		program->vars[(instruction ^ 0x6000) >> 8] = (uint8_t)instruction;
-		break;
-	case 0x7000: // 7XNN - add NN to register VX
-		program->vars[(instruction ^ 0x7000) >> 8] += (uint8_t)instruction;
-		break;
-	case 0xA000: // ANNN - set index register to NNN
-		program->index = instruction ^ 0xA000;
-		break;
-	case 0xD000: // DXYN - display
+	}
+}
+
+// Decodes the straight-line run of instructions starting at the given address.
+static program_block_entry_t* program_blocks_build(program_t* program, uint16_t pc)
+{
+	program_block_cache_t* cache = program->blocks;
+
+	if (cache->pool_used + PROGRAM_BLOCK_MAX_OPS > PROGRAM_BLOCK_POOL_OPS)
+		program_blocks_flush(program);
+
+	uint16_t start = cache->pool_used;
+	uint16_t addr = pc;
+	uint8_t len = 0;
+
+	while (len < PROGRAM_BLOCK_MAX_OPS)
 	{
-		// Treating lower-left as origin
-		uint8_t x, y, n;
-		x = ((instruction & 0x0F00) >> 8);
-		y = ((instruction & 0x00F0) >> 4);
-		n = (instruction & 0x000F);
+		uint16_t hi = addr & (program->memory_size - 1);
+		uint16_t lo = (addr + 1) & (program->memory_size - 1);
+		uint16_t instruction = (program->memory[hi] << 8) | program->memory[lo];
+
+		cache->code_map[hi >> 3] |= 1 << (hi & 7);
+		cache->code_map[lo >> 3] |= 1 << (lo & 7);
+
+		program_op_t* op = &cache->pool[start + len];
+		*op = program_decode_table[instruction];
+		op->handler = program->handlers[op->kind];
+		if (program_handler_unimplemented(op->handler))
+			op->flags |= k_op_flag_ends_block;
+		len++;
+		addr += 2;
+
+		if (op->flags & k_op_flag_ends_block)
+			break;
+	}
+
+	cache->pool_used += len;
+
+	for (uint8_t i = 0; i < len; i++)
+	{
+		program_block_entry_t* entry = &cache->entries[(pc + i * 2) & (program->memory_size - 1)];
+		entry->op = start + i;
+		entry->len = len - i;
+	}
 
-		uint8_t x_pos = program->vars[x] % 64;
-		uint8_t y_pos = program->vars[y] % 32;
+	return &cache->entries[pc];
+}
 
-		program->vars[0xf] = 0;
+// Tallies the instructions about to run from a block, starting at the given address.
+static void program_profile_count(program_profile_t* profile, uint32_t memory_size, uint16_t pc, const program_op_t* ops, uint32_t count)
+{
+	for (uint32_t i = 0; i < count; i++)
+	{
+		profile->op_counts[ops[i].kind]++;
+		profile->pc_counts[(pc + i * 2) & (memory_size - 1)]++;
+		profile->since_draw++;
 
-		for (int i = 0; i < n; i++)
+		if (ops[i].kind == k_op_drw)
 		{
-			for (int j = 0; j < 8; j++)
-			{
-				int mask = 1 << (7 - j);
-				uint8_t val = (*(program->memory + program->index + i) & mask) >> (7 - j);
-				if (val && y_pos + i < 32 && x_pos + j < 64)
-				{
-					if (program->display[y_pos + i][x_pos + j])
-					{
-						program->display[y_pos + i][x_pos + j] = false;
-						program->vars[0xF] = 1;
-					}
-					else
-					{
-						program->display[y_pos + i][x_pos + j] = true;
-					}
-				}
+			uint64_t gap = profile->since_draw;
+			int bucket = 0;
+			while (bucket < PROGRAM_PROFILE_GAP_BUCKETS - 1 && (gap >> (bucket + 1)))
+				bucket++;
+
+			profile->draw_gaps[bucket]++;
+			profile->draws++;
+			if (gap > profile->draw_gap_max)
+				profile->draw_gap_max = gap;
+			profile->since_draw = 0;
+		}
+	}
+}
 
-				if (x_pos + j >= 64)
-					break;
-			}
+// Runs up to max_ops instructions from the cached block at the program counter, decoding the block
+// first if needed. Returns the number of instructions executed.
+static uint32_t program_exec_block(program_t* program, uint32_t max_ops)
+{
+	program->pc &= program->memory_size - 1;
+
+	program_block_entry_t* entry = &program->blocks->entries[program->pc];
+	if (entry->len == 0)
+		entry = program_blocks_build(program, program->pc);
 
-			if (y_pos + i >= 32)
-				break;
+	const program_op_t* ops = program->blocks->pool + entry->op;
+
+	// Translations always run the whole block, so they're only used when it fits in the budget.
+	// Profiling needs to see every instruction, so it always interprets.
+	if (program->jit && !program->profile && entry->len <= max_ops)
+	{
+		// The block's last op may flush the cache (and the entry) by writing to code
+		uint32_t len = entry->len;
+		program_jit_fn_t fn = program_jit_lookup(program->jit, program->pc, ops, len);
+		if (fn)
+		{
+			fn(program);
+			return len;
 		}
+	}
+
+	uint32_t count = entry->len < max_ops ? entry->len : max_ops;
+
+	if (program->profile)
+		program_profile_count(program->profile, program->memory_size, program->pc, ops, count);
 
-		break;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		program->pc += 2;
+		ops[i].handler(program, &ops[i]);
 	}
-	default:
-		fprintf(stderr, "Program: encountered unknown instruction\n");
-		break;
+
+	return count;
+}
+
+// Sets the keys held on the keypad, bit n for key n. Hosts call this before running each frame, so
+// a run depends only on the keys given per frame. Releases while FX0A waits are what resume it.
+void program_set_keys(program_t* program, uint16_t keys)
+{
+	if (program->key_wait)
+		program->key_releases |= program->keys & ~keys;
+	program->keys = keys;
+}
+
+// Suspended in FX0A, with no release yet to resume it.
+bool program_key_wait(const program_t* program)
+{
+	return program->key_wait && program->key_releases == 0;
+}
+
+// Nothing changes by running: suspended in FX0A with both timers run down. Only new keys can wake it.
+bool program_idle(const program_t* program)
+{
+	return program_key_wait(program) && program->delay_timer == 0 && program->sound_timer == 0;
+}
+
+uint16_t program_keys(const program_t* program)
+{
+	return program->keys;
+}
+
+// Sound of the last frame: on if the sound timer was running at the last timer tick.
+void program_sound(const program_t* program, program_sound_t* sound)
+{
+	sound->on = program->beeping;
+	sound->pitch = program->pitch;
+	memcpy(sound->pattern, program->pattern, sizeof(sound->pattern));
+}
+
+program_platform_t program_platform(const program_t* program)
+{
+	return (program_platform_t)program->platform;
+}
+
+static const char* program_platform_names[k_program_platform_count] =
+{
+	[k_program_platform_chip8] = "chip8",
+	[k_program_platform_schip] = "schip",
+	[k_program_platform_xochip] = "xochip",
+};
+
+const char* program_platform_name(program_platform_t platform)
+{
+	return platform < k_program_platform_count ? program_platform_names[platform] : "unknown";
+}
+
+// Looks up a platform by the name program_platform_name gives it.
+bool program_platform_from_name(const char* name, program_platform_t* platform)
+{
+	for (int i = 0; i < k_program_platform_count; i++)
+	{
+		if (strcmp(name, program_platform_names[i]) == 0)
+		{
+			*platform = (program_platform_t)i;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// Selects how cached blocks are executed. Returns false if the backend isn't available on this
+// host, in which case the program keeps its current backend.
+bool program_set_backend(program_t* program, program_backend_t backend)
+{
+	if (backend == k_program_backend_jit)
+	{
+		if (program->jit)
+			return true;
+
+		program->jit = program_jit_init((program_platform_t)program->platform);
+		return program->jit != NULL;
 	}
+
+	program_jit_terminate(program->jit);
+	program->jit = NULL;
+	return true;
+}
+
+// Decrements the delay and sound timers. Called by the host at 60 Hz, independent of the
+// instruction rate.
+void program_tick_timers(program_t* program)
+{
+	program->beeping = program->sound_timer > 0;
+	if (program->delay_timer > 0)
+		program->delay_timer--;
+	if (program->sound_timer > 0)
+		program->sound_timer--;
+}
+
+// Runs up to max_cycles instructions. The predicate is checked after every draw and stops the run
+// when it returns true; pass NULL to never stop on draws.
+program_run_t program_run_until(program_t* program, uint64_t max_cycles, program_predicate_t predicate, void* user)
+{
+	program_run_t run = { .cycles = 0, .reason = k_program_stop_budget };
+
+	// Make sure there's actually a program running
+	if (!program->prog_loaded)
+	{
+		run.reason = k_program_stop_error;
+		return run;
+	}
+
+	// Suspended in FX0A: don't even fetch until a key is released
+	if (program_key_wait(program))
+	{
+		run.reason = k_program_stop_key_wait;
+		return run;
+	}
+
+	program->events = 0;
+
+	while (run.cycles < max_cycles)
+	{
+		uint64_t left = max_cycles - run.cycles;
+		run.cycles += program_exec_block(program, left > UINT32_MAX ? UINT32_MAX : (uint32_t)left);
+
+		// Events are only raised by the last op of a block, so checking here is enough
+		if (program->events == 0)
+			continue;
+
+		uint8_t events = program->events;
+		program->events = 0;
+
+		if (events & k_program_event_error)
+		{
+			run.reason = k_program_stop_error;
+			break;
+		}
+
+		if (events & k_program_event_key_wait)
+		{
+			run.reason = k_program_stop_key_wait;
+			break;
+		}
+
+		if (events & k_program_event_exit)
+		{
+			run.reason = k_program_stop_exit;
+			break;
+		}
+
+		if ((events & k_program_event_draw) && predicate && predicate(program, user))
+		{
+			run.reason = k_program_stop_draw;
+			break;
+		}
+	}
+
+	return run;
+}
+
+// Runs up to n instructions, stopping early only on errors or when waiting for a key.
+program_run_t program_run_cycles(program_t* program, uint64_t n)
+{
+	return program_run_until(program, n, NULL, NULL);
+}
+
+// Executes a single instruction.
+void program_update(program_t* program)
+{
+	program_run_cycles(program, 1);
 }
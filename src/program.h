@@ -1,9 +1,182 @@
 #pragma once
 
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
 typedef struct program_t program_t;
 
+// Execution backends
+typedef enum program_backend_t
+{
+	k_program_backend_interpreter, // Portable; runs decoded blocks through the handler table
+	k_program_backend_jit,         // x86-64 only; runs native translations of decoded blocks
+} program_backend_t;
+
+// Instruction sets, each with the quirks of the interpreter it follows. Every platform runs
+// through its own handler table, specialized at compile time.
+typedef enum program_platform_t
+{
+	k_program_platform_chip8, // COSMAC VIP: logic ops reset VF, shifts read VY, FX55/FX65 advance I, sprites clip
+	k_program_platform_schip, // SUPER-CHIP 1.1: adds 128 x 64 mode, scrolling and 16 x 16 sprites; shifts in place, BXNN adds VX
+	k_program_platform_xochip, // XO-CHIP: SUPER-CHIP plus 64 kB of memory, two bitplanes and long loads; sprites wrap
+	k_program_platform_count,
+} program_platform_t;
+
+// Why a run returned
+typedef enum program_stop_t
+{
+	k_program_stop_budget,   // Ran every requested instruction
+	k_program_stop_draw,     // The predicate accepted a draw
+	k_program_stop_key_wait, // Suspended in FX0A until a key is pressed and released
+	k_program_stop_error,    // Unknown instruction, stack overflow or underflow, or no program loaded
+	k_program_stop_exit,     // Halted by 00FD
+} program_stop_t;
+
+typedef struct program_run_t
+{
+	uint64_t cycles;         // Instructions actually executed
+	program_stop_t reason;
+} program_run_t;
+
+// What the machine plays during a frame. The pattern is also the classic beep: until XO-CHIP's F002
+// replaces it, it holds a square wave.
+typedef struct program_sound_t
+{
+	bool on;             // Sound timer running
+	uint8_t pitch;       // Pattern rate: 4000 * 2 ^ ((pitch - 64) / 48) samples per second
+	uint8_t pattern[16]; // 128 1-bit samples played in a loop, first in the high bit of byte 0
+} program_sound_t;
+
+// Checked by program_run_until after every draw. Returning true stops the run.
+typedef bool (*program_predicate_t)(const program_t* program, void* user);
+
+// Result of loading a ROM
+typedef enum program_load_error_t
+{
+	k_program_load_ok,
+	k_program_load_no_path,
+	k_program_load_not_found,
+	k_program_load_access_denied,
+	k_program_load_read_failed,
+	k_program_load_empty,
+	k_program_load_too_large,  // More than the platform's memory less 0x200 bytes
+} program_load_error_t;
+
+// Creates a program and loads the ROM at the given path into it. Returns NULL if the ROM can't be
+// loaded. Pass NULL to create a program without a ROM.
 program_t* program_init(char* file);
 
+// Like program_init, for the given platform instead of k_program_platform_chip8. The platform fixes
+// the size of memory, so it can't be changed afterwards.
+program_t* program_init_platform(char* file, program_platform_t platform);
+
+// Frees the program and everything it owns.
+void program_destroy(program_t* program);
+
+// Loads a ROM into memory at 0x200 and resets the program counter. "-" reads standard input.
+program_load_error_t program_load_file(program_t* program, const char* file_path);
+
+const char* program_load_error_string(program_load_error_t error);
+
+// Builds the decode table shared by all instances. program_init calls this; call it up front
+// before creating programs from more than one thread.
+void program_decode_init();
+
+// Copies a ROM image into memory at 0x200 and marks the program as loaded. Returns false if the
+// image doesn't fit.
+bool program_load_rom(program_t* program, const uint8_t* rom, size_t size);
+
+// Returns the display as RGB floats in a buffer owned by the program.
 float* program_display_to_rgb(program_t* program);
 
-void program_update(program_t* program);
\ No newline at end of file
+// Packed display: two bitplanes one after the other, each 64 rows of two 64-bit words (128 pixels),
+// leftmost pixel in the high bit of the first word. At 64 x 32 only the first word of the first 32
+// rows is used, and only XO-CHIP draws to the second plane. A pixel's colour is its bit in plane 0
+// plus twice its bit in plane 1.
+const uint64_t* program_display_rows(const program_t* program);
+
+// Number of bitplanes the platform draws to: 1, or 2 on XO-CHIP.
+uint32_t program_display_planes(const program_t* program);
+
+// Size of the display in pixels: 64 x 32, or 128 x 64 in SUPER-CHIP's high resolution mode.
+void program_display_size(const program_t* program, uint32_t* width, uint32_t* height);
+
+// Returns a mask with a bit set for each display row changed since the last call, and clears it.
+uint64_t program_display_take_dirty(program_t* program);
+
+// Hash of the display contents, stable across builds and storage formats.
+uint64_t program_display_hash(const program_t* program);
+
+// Hash of the ROM image last loaded, or 0 if none was. Identifies the ROM a replay was recorded with.
+uint64_t program_rom_hash(const program_t* program);
+
+// Writes registers, display and display hash as text.
+void program_print_state(const program_t* program, FILE* out);
+
+void program_update(program_t* program);
+
+// Runs up to n instructions in one call. Stops early on errors or when waiting for a key.
+program_run_t program_run_cycles(program_t* program, uint64_t n);
+
+// Like program_run_cycles, but also stops after any draw for which the predicate returns true.
+program_run_t program_run_until(program_t* program, uint64_t max_cycles, program_predicate_t predicate, void* user);
+
+// Decrements the delay and sound timers. Call at 60 Hz.
+void program_tick_timers(program_t* program);
+
+// Sets the keys held on the 16-key keypad, bit n for key n. Call once per frame, before running it;
+// scheduler_step_frame does so with the keys given to scheduler_set_keys.
+void program_set_keys(program_t* program, uint16_t keys);
+
+uint16_t program_keys(const program_t* program);
+
+// True while FX0A has the machine suspended. Runs return at once with k_program_stop_key_wait
+// until program_set_keys brings a key release.
+bool program_key_wait(const program_t* program);
+
+// True while suspended in FX0A with both timers at zero: running frames changes nothing, so the
+// host can stop the clock and block until its next input.
+bool program_idle(const program_t* program);
+
+// Sound state as of the last program_tick_timers, for handing to an audio thread once per frame.
+void program_sound(const program_t* program, program_sound_t* sound);
+
+program_platform_t program_platform(const program_t* program);
+
+// Short name of a platform ("chip8", "schip", "xochip"), as accepted by program_platform_from_name.
+const char* program_platform_name(program_platform_t platform);
+
+bool program_platform_from_name(const char* name, program_platform_t* platform);
+
+// Selects the execution backend. Both produce identical results; returns false if the backend
+// isn't supported on this host.
+bool program_set_backend(program_t* program, program_backend_t backend);
+
+// Must be called after writing to program memory from outside the core (e.g. loading a ROM), so
+// that instructions decoded from the old bytes are dropped.
+void program_invalidate(program_t* program, uint16_t addr, uint32_t len);
+
+// Starts or stops counting executions per instruction kind and address, and instructions between
+// draws. Starting clears earlier counts. While profiling, the program always interprets. Returns
+// false if the counters can't be allocated.
+bool program_set_profiling(program_t* program, bool enabled);
+
+// Writes the profile as JSON.
+void program_profile_write_json(const program_t* program, FILE* out);
+
+// Writes the per-address counts as folded stacks ("kind;address count"), for flame graph tools.
+void program_profile_write_folded(const program_t* program, FILE* out);
+
+// Size in bytes of the state blob written by program_save_state.
+size_t program_state_size(const program_t* program);
+
+// Serializes the whole machine (registers, stack, timers, platform, display and memory) into the
+// buffer as one versioned little-endian blob. Returns the number of bytes written, or 0 if the
+// buffer is smaller than program_state_size.
+size_t program_save_state(const program_t* program, void* buffer, size_t capacity);
+
+// Restores a blob written by program_save_state. Returns false, leaving the program untouched, if
+// it isn't a state of this version or was saved on another platform.
+bool program_load_state(program_t* program, const void* buffer, size_t size);
\ No newline at end of file
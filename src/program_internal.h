@@ -0,0 +1,239 @@
+#pragma once
+
+// Program internals. Shared by the core's translation units; hosts only see program.h.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "program.h"
+
+typedef struct program_block_cache_t program_block_cache_t;
+typedef struct program_jit_t program_jit_t;
+typedef struct program_profile_t program_profile_t;
+typedef struct program_op_t program_op_t;
+typedef void (*program_handler_t)(program_t* program, const program_op_t* op);
+
+#define PROGRAM_MEMORY_SIZE 4096    // CHIP-8 and SUPER-CHIP
+#define PROGRAM_MEMORY_MAX 0x10000  // XO-CHIP
+#define PROGRAM_CACHE_LINE 64
+
+// Display: up to 128 x 64 px, two words per row, in up to two bitplanes. Low resolution uses the
+// first word of the first 32 rows.
+#define PROGRAM_DISPLAY_WORDS 2
+#define PROGRAM_DISPLAY_ROWS 64
+#define PROGRAM_DISPLAY_PLANES 2
+
+// Built-in fonts
+#define PROGRAM_FONT_ADDR 0x050     // 4 x 5 hex digits, 5 bytes each
+#define PROGRAM_BIG_FONT_ADDR 0x0A0 // 8 x 10 hex digits, 10 bytes each
+
+typedef struct program_t
+{
+	// Architectural registers, all in the first cache line
+	uint16_t pc;		  // 16-bit program counter
+	uint16_t index;		  // 16-bit register for mem locations
+	uint8_t vars[16];	  // Labeled V0 through VF
+	uint8_t delay_timer;  // Decrements every frame (60fps) (independent of fetch/decode/exec loop)
+	uint8_t sound_timer;  // Behaves like delay timer but beeps while above 0
+	uint8_t sp;			  // Number of entries on the stack
+	uint8_t events;		  // k_program_event_* raised since the run loop last checked
+	uint16_t keys;		  // Held keypad keys, bit n for key n
+	uint16_t stack[16];	  // Return addresses
+	bool hires;			  // 128 x 64 mode (SUPER-CHIP)
+	uint8_t planes;		  // Bitplanes drawn to, bit n for plane n (set by XO-CHIP FN01)
+
+	// Host-side state, touched once per run or frame
+	_Alignas(PROGRAM_CACHE_LINE) uint64_t dirty_rows; // Bit per display row changed since the host last copied it out
+	uint8_t* memory;	  // All RAM, memory_size bytes, at PROGRAM_ARENA_MEMORY; the entire program is loaded in at startup
+	uint32_t memory_size; // Power of two, fixed by the platform
+	bool prog_loaded;     // Indicates whether or not a program is actually loaded
+	uint64_t rom_hash;	  // Of the ROM last loaded (see program_rom_hash)
+	uint8_t platform;	  // program_platform_t
+	uint32_t rng;		  // CXNN random state (xorshift)
+	uint8_t rpl[16];	  // FX75/FX85 flag registers
+	uint8_t pattern[16];  // 1-bit audio samples played in a loop while the sound timer runs (XO-CHIP F002)
+	uint8_t pitch;		  // Pattern playback rate: 4000 * 2 ^ ((pitch - 64) / 48) samples per second (FX3A)
+	bool beeping;		  // Sound timer was running during the last timer tick
+	bool key_wait;		  // Suspended in FX0A
+	uint16_t key_releases; // Keys released since FX0A started waiting
+	const program_handler_t* handlers; // Handler per program_op_kind_t, specialized for the platform
+	float* rgb;			  // Scratch buffer filled by program_display_to_rgb
+	program_block_cache_t* blocks; // Decoded straight-line runs of instructions, keyed by address
+	program_jit_t* jit;   // Native translations of cached blocks (NULL when interpreting)
+	program_profile_t* profile; // Execution counts (NULL when not profiling)
+
+	// Packed display planes, leftmost pixel in the high bit of a row's first word
+	_Alignas(PROGRAM_CACHE_LINE) uint64_t display[PROGRAM_DISPLAY_PLANES][PROGRAM_DISPLAY_ROWS][PROGRAM_DISPLAY_WORDS];
+} program_t;
+
+// RAM is sized by the platform (up to 64 kB on XO-CHIP), so rather than sitting inline it starts the
+// program's arena, straight after the struct. The arena is line-aligned, so RAM starts on a line
+// of its own at a fixed offset from the program.
+#define PROGRAM_ARENA_MEMORY sizeof(program_t)
+
+// Layout checks: the registers share one line, and the display and RAM each start on their own
+#define PROGRAM_IN_FIRST_LINE(field) (offsetof(program_t, field) + sizeof(((program_t*)0)->field) <= PROGRAM_CACHE_LINE)
+_Static_assert(PROGRAM_IN_FIRST_LINE(pc) && PROGRAM_IN_FIRST_LINE(index) && PROGRAM_IN_FIRST_LINE(vars)
+	&& PROGRAM_IN_FIRST_LINE(delay_timer) && PROGRAM_IN_FIRST_LINE(sound_timer) && PROGRAM_IN_FIRST_LINE(sp)
+	&& PROGRAM_IN_FIRST_LINE(events) && PROGRAM_IN_FIRST_LINE(keys) && PROGRAM_IN_FIRST_LINE(stack)
+	&& PROGRAM_IN_FIRST_LINE(hires) && PROGRAM_IN_FIRST_LINE(planes), "program_t registers must fit in the first cache line");
+_Static_assert(offsetof(program_t, display) % PROGRAM_CACHE_LINE == 0, "program_t display must be line-aligned");
+_Static_assert(_Alignof(program_t) == PROGRAM_CACHE_LINE, "program_t must be line-aligned");
+_Static_assert(PROGRAM_ARENA_MEMORY % PROGRAM_CACHE_LINE == 0, "program_t memory must be line-aligned");
+
+// Instruction kinds, used to identify a decoded instruction without comparing handlers.
+typedef enum program_op_kind_t
+{
+	k_op_unknown,
+	k_op_sys,       // 0NNN
+	k_op_cls,       // 00E0
+	k_op_ret,       // 00EE
+	k_op_jp,        // 1NNN
+	k_op_call,      // 2NNN
+	k_op_se_vx_nn,  // 3XNN
+	k_op_sne_vx_nn, // 4XNN
+	k_op_se_vx_vy,  // 5XY0
+	k_op_ld_vx_nn,  // 6XNN
+	k_op_add_vx_nn, // 7XNN
+	k_op_ld_vx_vy,  // 8XY0
+	k_op_or,        // 8XY1
+	k_op_and,       // 8XY2
+	k_op_xor,       // 8XY3
+	k_op_add_vx_vy, // 8XY4
+	k_op_sub,       // 8XY5
+	k_op_shr,       // 8XY6
+	k_op_subn,      // 8XY7
+	k_op_shl,       // 8XYE
+	k_op_sne_vx_vy, // 9XY0
+	k_op_ld_i,      // ANNN
+	k_op_jp_v0,     // BNNN
+	k_op_rnd,       // CXNN
+	k_op_drw,       // DXYN
+	k_op_skp,       // EX9E
+	k_op_sknp,      // EXA1
+	k_op_ld_vx_dt,  // FX07
+	k_op_ld_vx_k,   // FX0A
+	k_op_ld_dt_vx,  // FX15
+	k_op_ld_st_vx,  // FX18
+	k_op_add_i_vx,  // FX1E
+	k_op_ld_f_vx,   // FX29
+	k_op_ld_b_vx,   // FX33
+	k_op_ld_i_vx,   // FX55
+	k_op_ld_vx_i,   // FX65
+
+	// SUPER-CHIP
+	k_op_scd,       // 00CN
+	k_op_scr,       // 00FB
+	k_op_scl,       // 00FC
+	k_op_exit,      // 00FD
+	k_op_low,       // 00FE
+	k_op_high,      // 00FF
+	k_op_ld_hf_vx,  // FX30
+	k_op_ld_r_vx,   // FX75
+	k_op_ld_vx_r,   // FX85
+
+	// XO-CHIP
+	k_op_scu,       // 00DN
+	k_op_save_vx_vy, // 5XY2
+	k_op_load_vx_vy, // 5XY3
+	k_op_ld_i_long, // F000 NNNN
+	k_op_plane,     // FN01
+	k_op_audio,     // F002
+	k_op_pitch,     // FX3A
+
+	k_op_count,
+} program_op_kind_t;
+
+// Pre-decoded instruction: every operand field already extracted, plus the handler to run. The
+// shared decode table leaves the handler empty; it's filled in from the program's platform when
+// the instruction is copied into a block.
+typedef struct program_op_t
+{
+	program_handler_t handler;
+	uint16_t nnn;		  // Lowest 12 bits (address)
+	uint8_t x;			  // Second nibble (register)
+	uint8_t y;			  // Third nibble (register)
+	uint8_t n;			  // Lowest nibble
+	uint8_t nn;			  // Lowest byte
+	uint8_t kind;		  // program_op_kind_t
+	uint8_t flags;		  // k_op_flag_*
+} program_op_t;
+
+enum
+{
+	k_op_flag_ends_block = 1 << 0, // Changes control flow, writes memory or raises an event; always the last op of a block
+};
+
+// Events raised by handlers for the run loop. Only ops flagged k_op_flag_ends_block may raise them.
+enum
+{
+	k_program_event_draw = 1 << 0,
+	k_program_event_key_wait = 1 << 1,
+	k_program_event_error = 1 << 2,
+	k_program_event_exit = 1 << 3,
+};
+
+// Pixel x of a display row
+#define PROGRAM_PIXEL(row, x) (((row) >> (63 - (x))) & 1)
+#define PROGRAM_BLOCK_MAX_OPS 32
+#define PROGRAM_BLOCK_POOL_OPS 2048
+
+// Cached entry point into the op pool. Every address inside a block gets an entry pointing at the
+// remainder of that block, so execution that stops mid-block resumes without decoding again.
+typedef struct program_block_entry_t
+{
+	uint16_t op;		  // Index of the first op in the pool
+	uint8_t len;		  // Ops left until the end of the block (0 = not cached)
+} program_block_entry_t;
+
+// One record per 16-bit opcode, shared by every program instance. Built by program_decode_init.
+extern program_op_t program_decode_table[0x10000];
+
+// Behaviour differences between CHIP-8 implementations
+typedef struct program_quirks_t
+{
+	bool vf_reset;        // 8XY1/8XY2/8XY3 clear VF
+	bool shift_vx;        // 8XY6/8XYE shift VX in place instead of reading VY
+	bool index_increment; // FX55/FX65 leave I pointing past the last register
+	bool jump_vx;         // BXNN jumps to XNN + VX instead of NNN + V0
+	bool wrap;            // Sprites wrap around the screen edges instead of clipping
+	bool schip;           // 128 x 64 mode and 16 x 16 sprites
+	bool collision_rows;  // In 128 x 64 mode VF counts collided and clipped rows
+	bool xochip;          // Bitplanes, and skips step over both words of F000 NNNN
+	uint32_t memory_size; // Addresses wrap at this power of two
+} program_quirks_t;
+
+// The platform's quirk profile.
+const program_quirks_t* program_platform_quirks(program_platform_t platform);
+
+// Handlers for every program_op_kind_t, instantiated for the platform's quirks.
+const program_handler_t* program_platform_handlers(program_platform_t platform);
+
+// True for the handlers standing in for instructions a platform lacks (unknown, or ignored like
+// 0NNN). Ops resolving to them end their block whatever their kind.
+bool program_handler_unimplemented(program_handler_t handler);
+
+// Bytes of memory the platform addresses.
+uint32_t program_platform_memory_size(program_platform_t platform);
+
+typedef struct program_block_cache_t
+{
+	program_block_entry_t* entries; // One per byte of memory
+	uint8_t* code_map;	  // Bit set for every byte covered by a cached block
+	uint16_t pool_used;
+	program_op_t pool[PROGRAM_BLOCK_POOL_OPS];
+} program_block_cache_t;
+
+#define PROGRAM_PROFILE_GAP_BUCKETS 32
+
+// Per-instance execution counters. Only the owning thread touches them, so they're plain integers.
+typedef struct program_profile_t
+{
+	uint64_t op_counts[k_op_count];
+	uint64_t since_draw;   // Instructions since the last DXYN
+	uint64_t draws;
+	uint64_t draw_gap_max;
+	uint64_t draw_gaps[PROGRAM_PROFILE_GAP_BUCKETS]; // Instructions between draws; bucket b counts gaps in [2^b, 2^(b+1))
+	uint64_t pc_counts[];  // One per byte of memory
+} program_profile_t;
@@ -0,0 +1,476 @@
+// Program JIT
+// Translates cached blocks into x86-64 code. Register, ALU, index and skip ops are emitted natively
+// against fixed offsets into program_t and its RAM; everything else calls the interpreter's handler
+// for that op. The arena is only writable while a block is being emitted.
+
+#ifndef _WIN32
+#define _DEFAULT_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "program_jit.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define PROGRAM_JIT_X64
+#endif
+
+#ifdef PROGRAM_JIT_X64
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#endif
+
+#define PROGRAM_JIT_ARENA_SIZE (1 << 20)
+#define PROGRAM_JIT_BLOCK_MAX 2048 // Upper bound on code + data emitted for one block
+
+typedef struct program_jit_t
+{
+	uint8_t* arena;		  // Read-execute, except while emitting
+	size_t code_used;	  // Code grows up from the start of the arena
+	size_t data_used;	  // Op copies for interpreter fallbacks grow down from the end
+	const program_quirks_t* quirks;
+	uint32_t memory_size;
+	program_jit_fn_t* code; // Translation per block start address
+	uint8_t* len;		  // Ops covered by each translation
+} program_jit_t;
+
+#ifdef PROGRAM_JIT_X64
+
+// Maps the arena read-write. It's never writable and executable at once.
+static void* program_jit_alloc_exec(size_t size)
+{
+#ifdef _WIN32
+	return VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+	void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return mem == MAP_FAILED ? NULL : mem;
+#endif
+}
+
+// Switches the arena between read-write for emitting and read-execute for running.
+static bool program_jit_protect(void* mem, size_t size, bool writable)
+{
+#ifdef _WIN32
+	DWORD old;
+	return VirtualProtect(mem, size, writable ? PAGE_READWRITE : PAGE_EXECUTE_READ, &old) != 0;
+#else
+	return mprotect(mem, size, writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC) == 0;
+#endif
+}
+
+static void program_jit_free_exec(void* mem, size_t size)
+{
+#ifdef _WIN32
+	VirtualFree(mem, 0, MEM_RELEASE);
+#else
+	munmap(mem, size);
+#endif
+}
+
+// Emission helpers. rbx holds the program pointer for the whole block.
+static uint8_t* emit8(uint8_t* c, uint8_t v)
+{
+	*c = v;
+	return c + 1;
+}
+
+static uint8_t* emit16(uint8_t* c, uint16_t v)
+{
+	memcpy(c, &v, sizeof(v));
+	return c + sizeof(v);
+}
+
+static uint8_t* emit32(uint8_t* c, uint32_t v)
+{
+	memcpy(c, &v, sizeof(v));
+	return c + sizeof(v);
+}
+
+static uint8_t* emit64(uint8_t* c, uint64_t v)
+{
+	memcpy(c, &v, sizeof(v));
+	return c + sizeof(v);
+}
+
+// mov byte [rbx + disp], imm8
+static uint8_t* emit_store8(uint8_t* c, uint32_t disp, uint8_t imm)
+{
+	c = emit8(c, 0xC6);
+	c = emit8(c, 0x83);
+	c = emit32(c, disp);
+	return emit8(c, imm);
+}
+
+// add byte [rbx + disp], imm8
+static uint8_t* emit_add8(uint8_t* c, uint32_t disp, uint8_t imm)
+{
+	c = emit8(c, 0x80);
+	c = emit8(c, 0x83);
+	c = emit32(c, disp);
+	return emit8(c, imm);
+}
+
+// mov word [rbx + disp], imm16
+static uint8_t* emit_store16(uint8_t* c, uint32_t disp, uint16_t imm)
+{
+	c = emit8(c, 0x66);
+	c = emit8(c, 0xC7);
+	c = emit8(c, 0x83);
+	c = emit32(c, disp);
+	return emit16(c, imm);
+}
+
+// Registers for the reg field of emit_mem
+enum
+{
+	k_jit_al = 0, // Also eax / ax
+	k_jit_cl = 1,
+};
+
+// <opcode> reg, [rbx + disp] (or [rbx + disp], reg, depending on the opcode)
+static uint8_t* emit_mem(uint8_t* c, uint8_t opcode, uint8_t reg, uint32_t disp)
+{
+	c = emit8(c, opcode);
+	c = emit8(c, 0x83 | (reg << 3));
+	return emit32(c, disp);
+}
+
+// Ops on one register byte, each mov al/cl, [rbx + disp] etc.
+#define JIT_LOAD8 0x8A  // mov r8, [m]
+#define JIT_STORE8 0x88 // mov [m], r8
+#define JIT_OR8 0x0A    // or r8, [m]
+#define JIT_AND8 0x22   // and r8, [m]
+#define JIT_XOR8 0x32   // xor r8, [m]
+#define JIT_ADD8 0x02   // add r8, [m]
+#define JIT_SUB8 0x2A   // sub r8, [m]
+#define JIT_CMP8 0x3A   // cmp r8, [m]
+
+// VX = VX <op> VY through al
+static uint8_t* emit_alu_vx_vy(uint8_t* c, uint8_t opcode, uint32_t vx, uint32_t vy)
+{
+	c = emit_mem(c, JIT_LOAD8, k_jit_al, vx);
+	c = emit_mem(c, opcode, k_jit_al, vy);
+	return emit_mem(c, JIT_STORE8, k_jit_al, vx);
+}
+
+// VX = al, VF = cl. The flag is written last, so it wins when X is F.
+static uint8_t* emit_store_result(uint8_t* c, uint32_t vx, uint32_t vf)
+{
+	c = emit_mem(c, JIT_STORE8, k_jit_al, vx);
+	return emit_mem(c, JIT_STORE8, k_jit_cl, vf);
+}
+
+// Calls op->handler(program, op) using the host calling convention.
+static uint8_t* emit_call_handler(uint8_t* c, const program_op_t* op)
+{
+#ifdef _WIN32
+	c = emit8(c, 0x48); c = emit8(c, 0x89); c = emit8(c, 0xD9); // mov rcx, rbx
+	c = emit8(c, 0x48); c = emit8(c, 0xBA);                     // mov rdx, imm64
+#else
+	c = emit8(c, 0x48); c = emit8(c, 0x89); c = emit8(c, 0xDF); // mov rdi, rbx
+	c = emit8(c, 0x48); c = emit8(c, 0xBE);                     // mov rsi, imm64
+#endif
+	c = emit64(c, (uint64_t)(uintptr_t)op);
+	c = emit8(c, 0x48); c = emit8(c, 0xB8);                     // mov rax, imm64
+	c = emit64(c, (uint64_t)(uintptr_t)op->handler);
+	c = emit8(c, 0xFF); c = emit8(c, 0xD0);                     // call rax
+	return c;
+}
+
+// Sets the program counter to the given address and calls the op's handler on a copy of the op.
+static uint8_t* emit_fallback(program_jit_t* jit, uint8_t* c, const program_op_t* op, uint16_t addr)
+{
+	jit->data_used += sizeof(program_op_t);
+	program_op_t* copy = (program_op_t*)(jit->arena + PROGRAM_JIT_ARENA_SIZE - jit->data_used);
+	*copy = *op;
+
+	c = emit_store16(c, (uint32_t)offsetof(program_t, pc), addr);
+	return emit_call_handler(c, copy);
+}
+
+// 3XNN, 4XNN, 5XY0 and 9XY0, which always end their block: the program counter becomes the next op,
+// or the one after if the condition holds. On XO-CHIP that's two words further when the op skipped
+// is F000 NNNN, which is read from RAM when the skip is taken, as the interpreter does.
+static uint8_t* emit_skip(program_jit_t* jit, uint8_t* c, const program_op_t* op, uint16_t addr)
+{
+	const uint32_t pc_disp = (uint32_t)offsetof(program_t, pc);
+	const uint32_t vars_disp = (uint32_t)offsetof(program_t, vars);
+
+	c = emit_store16(c, pc_disp, addr);
+	c = emit_mem(c, JIT_LOAD8, k_jit_al, vars_disp + op->x);
+	if (op->kind == k_op_se_vx_nn || op->kind == k_op_sne_vx_nn)
+	{
+		c = emit8(c, 0x3C);                                     // cmp al, imm8
+		c = emit8(c, op->nn);
+	}
+	else
+	{
+		c = emit_mem(c, JIT_CMP8, k_jit_al, vars_disp + op->y);
+	}
+
+	bool equal = op->kind == k_op_se_vx_nn || op->kind == k_op_se_vx_vy;
+	c = emit8(c, equal ? 0x75 : 0x74);                          // jne / je over the skip
+	uint8_t* over = c;
+	c = emit8(c, 0);
+
+	c = emit_store16(c, pc_disp, addr + 2);
+	if (jit->quirks->xochip)
+	{
+		// RAM sits at a fixed offset from the program; F0 00 reads as 0x00F0
+		c = emit8(c, 0x66); c = emit8(c, 0x81); c = emit8(c, 0xBB); // cmp word [rbx + disp], imm16
+		c = emit32(c, (uint32_t)(PROGRAM_ARENA_MEMORY + (addr & (jit->memory_size - 1))));
+		c = emit16(c, 0x00F0);
+		c = emit8(c, 0x75);                                     // jne over the long skip
+		uint8_t* two = c;
+		c = emit8(c, 0);
+		c = emit_store16(c, pc_disp, addr + 4);
+		*two = (uint8_t)(c - two - 1);
+	}
+
+	*over = (uint8_t)(c - over - 1);
+	return c;
+}
+
+// Translates one block. The arena must be writable and have PROGRAM_JIT_BLOCK_MAX bytes free.
+static program_jit_fn_t program_jit_compile(program_jit_t* jit, uint16_t pc, const program_op_t* ops, uint8_t len)
+{
+	const uint32_t pc_disp = (uint32_t)offsetof(program_t, pc);
+	const uint32_t index_disp = (uint32_t)offsetof(program_t, index);
+	const uint32_t vars_disp = (uint32_t)offsetof(program_t, vars);
+	const uint32_t vf_disp = vars_disp + 0xF;
+	const uint32_t dt_disp = (uint32_t)offsetof(program_t, delay_timer);
+	const uint32_t st_disp = (uint32_t)offsetof(program_t, sound_timer);
+
+	uint8_t* start = jit->arena + jit->code_used;
+	uint8_t* c = start;
+
+	// Prologue: keep the program pointer in rbx
+	c = emit8(c, 0x53);                                         // push rbx
+#ifdef _WIN32
+	c = emit8(c, 0x48); c = emit8(c, 0x89); c = emit8(c, 0xCB); // mov rbx, rcx
+	c = emit8(c, 0x48); c = emit8(c, 0x83); c = emit8(c, 0xEC); c = emit8(c, 0x20); // sub rsp, 32
+#else
+	c = emit8(c, 0x48); c = emit8(c, 0x89); c = emit8(c, 0xFB); // mov rbx, rdi
+#endif
+
+	// The program counter is only materialized where it can be observed: before interpreter
+	// fallbacks and at the end of the block.
+	bool pc_written = false;
+	uint16_t addr = pc;
+
+	for (uint8_t i = 0; i < len; i++)
+	{
+		const program_op_t* op = &ops[i];
+		const uint32_t vx = vars_disp + op->x;
+		const uint32_t vy = vars_disp + op->y;
+		addr += 2;
+		pc_written = false;
+
+		switch (op->kind)
+		{
+		case k_op_sys:
+			break;
+		case k_op_ld_vx_nn:
+			c = emit_store8(c, vars_disp + op->x, op->nn);
+			break;
+		case k_op_add_vx_nn:
+			c = emit_add8(c, vars_disp + op->x, op->nn);
+			break;
+		case k_op_ld_i:
+			c = emit_store16(c, index_disp, op->nnn);
+			break;
+		case k_op_jp:
+			c = emit_store16(c, pc_disp, op->nnn);
+			pc_written = true;
+			break;
+		case k_op_se_vx_nn:
+		case k_op_sne_vx_nn:
+		case k_op_se_vx_vy:
+		case k_op_sne_vx_vy:
+			// An F000 split across the end of RAM isn't worth a native path
+			if (jit->quirks->xochip && (addr & (jit->memory_size - 1)) == jit->memory_size - 1)
+				c = emit_fallback(jit, c, op, addr);
+			else
+				c = emit_skip(jit, c, op, addr);
+			pc_written = true;
+			break;
+		case k_op_ld_vx_vy:
+			c = emit_mem(c, JIT_LOAD8, k_jit_al, vy);
+			c = emit_mem(c, JIT_STORE8, k_jit_al, vx);
+			break;
+		case k_op_or:
+		case k_op_and:
+		case k_op_xor:
+			c = emit_alu_vx_vy(c, op->kind == k_op_or ? JIT_OR8 : op->kind == k_op_and ? JIT_AND8 : JIT_XOR8, vx, vy);
+			if (jit->quirks->vf_reset)
+				c = emit_store8(c, vf_disp, 0);
+			break;
+		case k_op_add_vx_vy:
+			c = emit_mem(c, JIT_LOAD8, k_jit_al, vx);
+			c = emit_mem(c, JIT_ADD8, k_jit_al, vy);
+			c = emit8(c, 0x0F); c = emit8(c, 0x92); c = emit8(c, 0xC1); // setc cl
+			c = emit_store_result(c, vx, vf_disp);
+			break;
+		case k_op_sub:
+		case k_op_subn:
+			c = emit_mem(c, JIT_LOAD8, k_jit_al, op->kind == k_op_sub ? vx : vy);
+			c = emit_mem(c, JIT_SUB8, k_jit_al, op->kind == k_op_sub ? vy : vx);
+			c = emit8(c, 0x0F); c = emit8(c, 0x93); c = emit8(c, 0xC1); // setnc cl
+			c = emit_store_result(c, vx, vf_disp);
+			break;
+		case k_op_shr:
+			c = emit_mem(c, JIT_LOAD8, k_jit_al, jit->quirks->shift_vx ? vx : vy);
+			c = emit8(c, 0x88); c = emit8(c, 0xC1);                 // mov cl, al
+			c = emit8(c, 0x80); c = emit8(c, 0xE1); c = emit8(c, 0x01); // and cl, 1
+			c = emit8(c, 0xD0); c = emit8(c, 0xE8);                 // shr al, 1
+			c = emit_store_result(c, vx, vf_disp);
+			break;
+		case k_op_shl:
+			c = emit_mem(c, JIT_LOAD8, k_jit_al, jit->quirks->shift_vx ? vx : vy);
+			c = emit8(c, 0x88); c = emit8(c, 0xC1);                 // mov cl, al
+			c = emit8(c, 0xC0); c = emit8(c, 0xE9); c = emit8(c, 0x07); // shr cl, 7
+			c = emit8(c, 0x00); c = emit8(c, 0xC0);                 // add al, al
+			c = emit_store_result(c, vx, vf_disp);
+			break;
+		case k_op_ld_vx_dt:
+			c = emit_mem(c, JIT_LOAD8, k_jit_al, dt_disp);
+			c = emit_mem(c, JIT_STORE8, k_jit_al, vx);
+			break;
+		case k_op_ld_dt_vx:
+		case k_op_ld_st_vx:
+			c = emit_mem(c, JIT_LOAD8, k_jit_al, vx);
+			c = emit_mem(c, JIT_STORE8, k_jit_al, op->kind == k_op_ld_dt_vx ? dt_disp : st_disp);
+			break;
+		case k_op_add_i_vx:
+			c = emit8(c, 0x0F); c = emit_mem(c, 0xB6, k_jit_al, vx);  // movzx eax, byte [vx]
+			c = emit8(c, 0x66); c = emit_mem(c, 0x01, k_jit_al, index_disp); // add [index], ax
+			break;
+		case k_op_ld_f_vx:
+			c = emit8(c, 0x0F); c = emit_mem(c, 0xB6, k_jit_al, vx);  // movzx eax, byte [vx]
+			c = emit8(c, 0x83); c = emit8(c, 0xE0); c = emit8(c, 0x0F); // and eax, 0xF
+			c = emit8(c, 0x8D); c = emit8(c, 0x84); c = emit8(c, 0x80); // lea eax, [rax + rax * 4 + font]
+			c = emit32(c, PROGRAM_FONT_ADDR);
+			c = emit8(c, 0x66); c = emit_mem(c, 0x89, k_jit_al, index_disp); // mov [index], ax
+			break;
+		default:
+			c = emit_fallback(jit, c, op, addr);
+			pc_written = true;
+			break;
+		}
+	}
+
+	if (!pc_written)
+		c = emit_store16(c, pc_disp, addr);
+
+	// Epilogue
+#ifdef _WIN32
+	c = emit8(c, 0x48); c = emit8(c, 0x83); c = emit8(c, 0xC4); c = emit8(c, 0x20); // add rsp, 32
+#endif
+	c = emit8(c, 0x5B);                                         // pop rbx
+	c = emit8(c, 0xC3);                                         // ret
+
+	jit->code_used += c - start;
+	return (program_jit_fn_t)(void*)start;
+}
+
+program_jit_t* program_jit_init(program_platform_t platform)
+{
+	program_jit_t* jit = calloc(1, sizeof(program_jit_t));
+	if (jit)
+	{
+		jit->quirks = program_platform_quirks(platform);
+		jit->memory_size = jit->quirks->memory_size;
+		jit->code = calloc(jit->memory_size, sizeof(program_jit_fn_t));
+		jit->len = calloc(jit->memory_size, sizeof(uint8_t));
+	}
+	if (jit == NULL || jit->code == NULL || jit->len == NULL)
+	{
+		fprintf(stderr, "JIT: failed to allocate memory for object\n");
+		program_jit_terminate(jit);
+		return NULL;
+	}
+
+	jit->arena = program_jit_alloc_exec(PROGRAM_JIT_ARENA_SIZE);
+	if (jit->arena == NULL || !program_jit_protect(jit->arena, PROGRAM_JIT_ARENA_SIZE, false))
+	{
+		fprintf(stderr, "JIT: failed to allocate executable memory\n");
+		program_jit_terminate(jit);
+		return NULL;
+	}
+
+	return jit;
+}
+
+void program_jit_terminate(program_jit_t* jit)
+{
+	if (jit == NULL)
+		return;
+
+	if (jit->arena)
+		program_jit_free_exec(jit->arena, PROGRAM_JIT_ARENA_SIZE);
+	free(jit->code);
+	free(jit->len);
+	free(jit);
+}
+
+void program_jit_flush(program_jit_t* jit)
+{
+	memset(jit->code, 0, sizeof(program_jit_fn_t) * jit->memory_size);
+	jit->code_used = 0;
+	jit->data_used = 0;
+}
+
+program_jit_fn_t program_jit_lookup(program_jit_t* jit, uint16_t pc, const program_op_t* ops, uint8_t len)
+{
+	// Overlapping blocks can leave a shorter run at an address that was translated before
+	if (jit->code[pc] && jit->len[pc] == len)
+		return jit->code[pc];
+
+	// Op copies are 16-byte aligned from the end of the arena, code is packed at the start
+	jit->data_used = (jit->data_used + 15) & ~(size_t)15;
+	if (jit->code_used + jit->data_used + PROGRAM_JIT_BLOCK_MAX > PROGRAM_JIT_ARENA_SIZE)
+		program_jit_flush(jit);
+
+	if (!program_jit_protect(jit->arena, PROGRAM_JIT_ARENA_SIZE, true))
+		return NULL;
+	program_jit_fn_t fn = program_jit_compile(jit, pc, ops, len);
+
+	// If the arena can't be made executable again, nothing in it can run
+	if (!program_jit_protect(jit->arena, PROGRAM_JIT_ARENA_SIZE, false))
+	{
+		program_jit_flush(jit);
+		return NULL;
+	}
+
+	jit->code[pc] = fn;
+	jit->len[pc] = len;
+	return fn;
+}
+
+#else
+
+program_jit_t* program_jit_init(program_platform_t platform)
+{
+	return NULL;
+}
+
+void program_jit_terminate(program_jit_t* jit)
+{
+}
+
+void program_jit_flush(program_jit_t* jit)
+{
+}
+
+program_jit_fn_t program_jit_lookup(program_jit_t* jit, uint16_t pc, const program_op_t* ops, uint8_t len)
+{
+	return NULL;
+}
+
+#endif
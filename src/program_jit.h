@@ -0,0 +1,20 @@
+#pragma once
+
+// x86-64 translator for cached blocks. Internal to the core.
+
+#include "program_internal.h"
+
+typedef void (*program_jit_fn_t)(program_t* program);
+
+// Creates a translator with its own code arena, for a program on the given platform. Returns NULL
+// when the host can't run generated code (not x86-64, or executable memory was refused).
+program_jit_t* program_jit_init(program_platform_t platform);
+
+void program_jit_terminate(program_jit_t* jit);
+
+// Drops every translation. Must be called whenever the block cache is flushed.
+void program_jit_flush(program_jit_t* jit);
+
+// Returns the translation of the block starting at pc, compiling it from the given ops if needed.
+// Returns NULL if the block can't be translated; the caller should interpret it instead.
+program_jit_fn_t program_jit_lookup(program_jit_t* jit, uint16_t pc, const program_op_t* ops, uint8_t len);
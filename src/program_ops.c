@@ -0,0 +1,899 @@
+// Program Ops
+// Decoding and instruction handlers. Handlers affected by quirks are written once against a quirk
+// profile and instantiated per platform, so each platform gets its own handler table and no quirk
+// is tested while running.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "program.h"
+#include "program_internal.h"
+
+program_op_t program_decode_table[0x10000];
+static bool program_decode_ready;
+
+// Quirk profiles. Only ever read through these constants, so every test folds away in the
+// instantiated handlers.
+static const program_quirks_t k_quirks_chip8 =
+{
+	.vf_reset = true,
+	.index_increment = true,
+	.memory_size = PROGRAM_MEMORY_SIZE,
+};
+
+static const program_quirks_t k_quirks_schip =
+{
+	.shift_vx = true,
+	.jump_vx = true,
+	.schip = true,
+	.collision_rows = true,
+	.memory_size = PROGRAM_MEMORY_SIZE,
+};
+
+static const program_quirks_t k_quirks_xochip =
+{
+	.index_increment = true,
+	.wrap = true,
+	.schip = true,
+	.xochip = true,
+	.memory_size = PROGRAM_MEMORY_MAX,
+};
+
+const program_quirks_t* program_platform_quirks(program_platform_t platform)
+{
+	switch (platform)
+	{
+	case k_program_platform_schip: return &k_quirks_schip;
+	case k_program_platform_xochip: return &k_quirks_xochip;
+	default: return &k_quirks_chip8;
+	}
+}
+
+uint32_t program_platform_memory_size(program_platform_t platform)
+{
+	return program_platform_quirks(platform)->memory_size;
+}
+
+// Rows of the display in the current mode
+static inline int program_display_height(const program_t* program)
+{
+	return program->hires ? PROGRAM_DISPLAY_ROWS : PROGRAM_DISPLAY_ROWS / 2;
+}
+
+static inline uint64_t program_display_mask(const program_t* program)
+{
+	return program->hires ? ~0ULL : 0xFFFFFFFFULL;
+}
+
+// Skips the next instruction. On XO-CHIP that's two words when it's F000 NNNN.
+static inline void program_skip(program_t* program, const program_quirks_t* quirks)
+{
+	if (quirks->xochip
+		&& program->memory[program->pc % quirks->memory_size] == 0xF0
+		&& program->memory[(program->pc + 1) % quirks->memory_size] == 0x00)
+		program->pc += 4;
+	else
+		program->pc += 2;
+}
+
+// Instruction handlers. The program counter already points past the instruction when these run.
+
+static void program_op_unknown(program_t* program, const program_op_t* op)
+{
+	fprintf(stderr, "Program: encountered unknown instruction\n");
+	program->events |= k_program_event_error;
+}
+
+// 0NNN - machine code routine (ignored)
+static void program_op_sys(program_t* program, const program_op_t* op)
+{
+}
+
+// 00E0 - clear the selected planes
+static void program_op_cls(program_t* program, const program_op_t* op)
+{
+	for (int p = 0; p < PROGRAM_DISPLAY_PLANES; p++)
+		if (program->planes & (1 << p))
+			memset(program->display[p], 0, sizeof(program->display[p]));
+	program->dirty_rows = ~0ULL;
+
+	program->events |= k_program_event_draw;
+}
+
+// 00EE - return from subroutine
+static void program_op_ret(program_t* program, const program_op_t* op)
+{
+	if (program->sp == 0)
+	{
+		fprintf(stderr, "Program: return with an empty stack\n");
+		program->events |= k_program_event_error;
+		return;
+	}
+
+	program->pc = program->stack[--program->sp];
+}
+
+// 1NNN - jump to 0xNNN
+static void program_op_jp(program_t* program, const program_op_t* op)
+{
+	program->pc = op->nnn;
+}
+
+// 2NNN - call subroutine at 0xNNN
+static void program_op_call(program_t* program, const program_op_t* op)
+{
+	if (program->sp == 16)
+	{
+		fprintf(stderr, "Program: stack overflow\n");
+		program->events |= k_program_event_error;
+		return;
+	}
+
+	program->stack[program->sp++] = program->pc;
+	program->pc = op->nnn;
+}
+
+// 3XNN - skip if VX == NN
+static inline void program_op_se_vx_nn_impl(program_t* program, const program_op_t* op, const program_quirks_t* quirks)
+{
+	if (program->vars[op->x] == op->nn)
+		program_skip(program, quirks);
+}
+
+// 4XNN - skip if VX != NN
+static inline void program_op_sne_vx_nn_impl(program_t* program, const program_op_t* op, const program_quirks_t* quirks)
+{
+	if (program->vars[op->x] != op->nn)
+		program_skip(program, quirks);
+}
+
+// 5XY0 - skip if VX == VY
+static inline void program_op_se_vx_vy_impl(program_t* program, const program_op_t* op, const program_quirks_t* quirks)
+{
+	if (program->vars[op->x] == program->vars[op->y])
+		program_skip(program, quirks);
+}
+
+// 6XNN - set register VX to NN
+static void program_op_ld_vx_nn(program_t* program, const program_op_t* op)
+{
+	program->vars[op->x] = op->nn;
+}
+
+// 7XNN - add NN to register VX
+static void program_op_add_vx_nn(program_t* program, const program_op_t* op)
+{
+	program->vars[op->x] += op->nn;
+}
+
+// 8XY0 - set VX to VY
+static void program_op_ld_vx_vy(program_t* program, const program_op_t* op)
+{
+	program->vars[op->x] = program->vars[op->y];
+}
+
+// 8XY1 - VX |= VY
+static inline void program_op_or_impl(program_t* program, const program_op_t* op, const program_quirks_t* quirks)
+{
+	program->vars[op->x] |= program->vars[op->y];
+	if (quirks->vf_reset)
+		program->vars[0xF] = 0;
+}
+
+// 8XY2 - VX &= VY
+static inline void program_op_and_impl(program_t* program, const program_op_t* op, const program_quirks_t* quirks)
+{
+	program->vars[op->x] &= program->vars[op->y];
+	if (quirks->vf_reset)
+		program->vars[0xF] = 0;
+}
+
+// 8XY3 - VX ^= VY
+static inline void program_op_xor_impl(program_t* program, const program_op_t* op, const program_quirks_t* quirks)
+{
+	program->vars[op->x] ^= program->vars[op->y];
+	if (quirks->vf_reset)
+		program->vars[0xF] = 0;
+}
+
+// 8XY4 - VX += VY, VF = carry
+// The flag is written after the result, so it wins when X is F.
+static void program_op_add_vx_vy(program_t* program, const program_op_t* op)
+{
+	uint16_t sum = program->vars[op->x] + program->vars[op->y];
+	program->vars[op->x] = (uint8_t)sum;
+	program->vars[0xF] = sum > 0xFF;
+}
+
+// 8XY5 - VX -= VY, VF = no borrow
+static void program_op_sub(program_t* program, const program_op_t* op)
+{
+	uint8_t vx = program->vars[op->x], vy = program->vars[op->y];
+	program->vars[op->x] = vx - vy;
+	program->vars[0xF] = vx >= vy;
+}
+
+// 8XY6 - VX = VY >> 1 (or VX >> 1), VF = bit shifted out
+static inline void program_op_shr_impl(program_t* program, const program_op_t* op, const program_quirks_t* quirks)
+{
+	uint8_t src = program->vars[quirks->shift_vx ? op->x : op->y];
+	program->vars[op->x] = src >> 1;
+	program->vars[0xF] = src & 1;
+}
+
+// 8XY7 - VX = VY - VX, VF = no borrow
+static void program_op_subn(program_t* program, const program_op_t* op)
+{
+	uint8_t vx = program->vars[op->x], vy = program->vars[op->y];
+	program->vars[op->x] = vy - vx;
+	program->vars[0xF] = vy >= vx;
+}
+
+// 8XYE - VX = VY << 1 (or VX << 1), VF = bit shifted out
+static inline void program_op_shl_impl(program_t* program, const program_op_t* op, const program_quirks_t* quirks)
+{
+	uint8_t src = program->vars[quirks->shift_vx ? op->x : op->y];
+	program->vars[op->x] = src << 1;
+	program->vars[0xF] = src >> 7;
+}
+
+// 9XY0 - skip if VX != VY
+static inline void program_op_sne_vx_vy_impl(program_t* program, const program_op_t* op, const program_quirks_t* quirks)
+{
+	if (program->vars[op->x] != program->vars[op->y])
+		program_skip(program, quirks);
+}
+
+// ANNN - set index register to NNN
+static void program_op_ld_i(program_t* program, const program_op_t* op)
+{
+	program->index = op->nnn;
+}
+
+// BNNN - jump to NNN + V0 (BXNN - XNN + VX)
+static inline void program_op_jp_v0_impl(program_t* program, const program_op_t* op, const program_quirks_t* quirks)
+{
+	program->pc = (op->nnn + program->vars[quirks->jump_vx ? op->x : 0]) % quirks->memory_size;
+}
+
+// CXNN - VX = random byte & NN
+static void program_op_rnd(program_t* program, const program_op_t* op)
+{
+	// xorshift32; the state is part of the machine so runs and replays are reproducible
+	uint32_t r = program->rng;
+	r ^= r << 13;
+	r ^= r >> 17;
+	r ^= r << 5;
+	program->rng = r;
+
+	program->vars[op->x] = (uint8_t)(r >> 24) & op->nn;
+}
+
+// DXYN - display
+// Each sprite row is placed with one shift, tested for collision with one AND and drawn with one XOR
+// per display word it touches. DXY0 draws a 16 x 16 sprite on SUPER-CHIP. On XO-CHIP the sprite is
+// drawn into each selected plane in turn, reading the next plane's rows right after the last.
+static inline void program_op_drw_impl(program_t* program, const program_op_t* op, const program_quirks_t* quirks)
+{
+	bool hires = quirks->schip && program->hires;
+	int words = hires ? 2 : 1;
+	int height = hires ? PROGRAM_DISPLAY_ROWS : PROGRAM_DISPLAY_ROWS / 2;
+	int x_pos = program->vars[op->x] & (words * 64 - 1);
+	int y_pos = program->vars[op->y] & (height - 1);
+	int word = x_pos >> 6, shift = x_pos & 63;
+	bool big = quirks->schip && op->n == 0;
+	int rows = big ? 16 : op->n;
+	int planes = quirks->xochip ? program->planes : 1;
+	uint32_t addr = program->index;
+	uint32_t hits = 0;
+
+	for (int p = 0; p < PROGRAM_DISPLAY_PLANES; p++)
+	{
+		if (!(planes & (1 << p)))
+			continue;
+
+		for (int i = 0; i < rows; i++)
+		{
+			int row = y_pos + i;
+			if (row >= height)
+			{
+				if (!quirks->wrap)
+				{
+					// SUPER-CHIP counts the rows that fell off the bottom as collisions
+					if (quirks->collision_rows && hires)
+						hits += rows - i;
+					break;
+				}
+				row -= height;
+			}
+
+			uint64_t sprite;
+			if (big)
+				sprite = (uint64_t)program->memory[(addr + i * 2) % quirks->memory_size] << 56
+					| (uint64_t)program->memory[(addr + i * 2 + 1) % quirks->memory_size] << 48;
+			else
+				sprite = (uint64_t)program->memory[(addr + i) % quirks->memory_size] << 56;
+
+			// The part of the sprite past the end of the word spills into the next one, or wraps
+			uint64_t* line = program->display[p][row];
+			uint64_t left = sprite >> shift;
+			uint64_t collision = line[word] & left;
+			line[word] ^= left;
+
+			int next = word + 1;
+			if (next == words)
+				next = quirks->wrap ? 0 : -1;
+			if (shift && next >= 0)
+			{
+				uint64_t right = sprite << (64 - shift);
+				collision |= line[next] & right;
+				line[next] ^= right;
+			}
+
+			hits += collision != 0;
+			program->dirty_rows |= 1ULL << row;
+		}
+
+		addr += big ? 32 : rows;
+	}
+
+	program->vars[0xF] = quirks->collision_rows && hires ? (uint8_t)hits : hits != 0;
+
+	program->events |= k_program_event_draw;
+}
+
+// EX9E - skip if key VX is held
+static inline void program_op_skp_impl(program_t* program, const program_op_t* op, const program_quirks_t* quirks)
+{
+	if (program->keys & (1 << (program->vars[op->x] & 0xF)))
+		program_skip(program, quirks);
+}
+
+// EXA1 - skip if key VX isn't held
+static inline void program_op_sknp_impl(program_t* program, const program_op_t* op, const program_quirks_t* quirks)
+{
+	if (!(program->keys & (1 << (program->vars[op->x] & 0xF))))
+		program_skip(program, quirks);
+}
+
+// FX07 - VX = delay timer
+static void program_op_ld_vx_dt(program_t* program, const program_op_t* op)
+{
+	program->vars[op->x] = program->delay_timer;
+}
+
+// FX0A - wait for a key to be pressed and released, then VX = key
+// Until program_set_keys reports a release the instruction repeats and the machine is suspended:
+// the run stops, and later runs return at once without executing anything.
+static void program_op_ld_vx_k(program_t* program, const program_op_t* op)
+{
+	if (program->key_releases == 0)
+	{
+		program->key_wait = true;
+		program->pc -= 2;
+		program->events |= k_program_event_key_wait;
+		return;
+	}
+
+	uint8_t key = 0;
+	while (!(program->key_releases & (1 << key)))
+		key++;
+	program->vars[op->x] = key;
+	program->key_wait = false;
+	program->key_releases = 0;
+}
+
+// FX15 - delay timer = VX
+static void program_op_ld_dt_vx(program_t* program, const program_op_t* op)
+{
+	program->delay_timer = program->vars[op->x];
+}
+
+// FX18 - sound timer = VX
+static void program_op_ld_st_vx(program_t* program, const program_op_t* op)
+{
+	program->sound_timer = program->vars[op->x];
+}
+
+// FX1E - I += VX
+static void program_op_add_i_vx(program_t* program, const program_op_t* op)
+{
+	program->index += program->vars[op->x];
+}
+
+// FX29 - I = small font character VX
+static void program_op_ld_f_vx(program_t* program, const program_op_t* op)
+{
+	program->index = PROGRAM_FONT_ADDR + (program->vars[op->x] & 0xF) * 5;
+}
+
+// FX33 - BCD of VX at I, I + 1, I + 2
+static inline void program_op_ld_b_vx_impl(program_t* program, const program_op_t* op, const program_quirks_t* quirks)
+{
+	uint8_t vx = program->vars[op->x];
+	program->memory[program->index % quirks->memory_size] = vx / 100;
+	program->memory[(program->index + 1) % quirks->memory_size] = vx / 10 % 10;
+	program->memory[(program->index + 2) % quirks->memory_size] = vx % 10;
+
+	program_invalidate(program, program->index, 3);
+}
+
+// FX55 - store V0 through VX at I
+static inline void program_op_ld_i_vx_impl(program_t* program, const program_op_t* op, const program_quirks_t* quirks)
+{
+	for (int i = 0; i <= op->x; i++)
+		program->memory[(program->index + i) % quirks->memory_size] = program->vars[i];
+
+	program_invalidate(program, program->index, op->x + 1);
+	if (quirks->index_increment)
+		program->index += op->x + 1;
+}
+
+// FX65 - load V0 through VX from I
+static inline void program_op_ld_vx_i_impl(program_t* program, const program_op_t* op, const program_quirks_t* quirks)
+{
+	for (int i = 0; i <= op->x; i++)
+		program->vars[i] = program->memory[(program->index + i) % quirks->memory_size];
+
+	if (quirks->index_increment)
+		program->index += op->x + 1;
+}
+
+// SUPER-CHIP handlers. Scrolls move whole words of the packed rows of the selected planes, in pixels
+// of the current mode.
+
+// 00CN - scroll down N rows
+static void program_op_scd(program_t* program, const program_op_t* op)
+{
+	int height = program_display_height(program);
+	int n = op->n < height ? op->n : height;
+
+	for (int p = 0; p < PROGRAM_DISPLAY_PLANES; p++)
+	{
+		if (!(program->planes & (1 << p)))
+			continue;
+
+		memmove(program->display[p][n], program->display[p][0], sizeof(program->display[p][0]) * (height - n));
+		memset(program->display[p][0], 0, sizeof(program->display[p][0]) * n);
+	}
+	program->dirty_rows |= program_display_mask(program);
+
+	program->events |= k_program_event_draw;
+}
+
+// 00FB - scroll right 4 pixels
+static void program_op_scr(program_t* program, const program_op_t* op)
+{
+	int height = program_display_height(program);
+
+	for (int p = 0; p < PROGRAM_DISPLAY_PLANES; p++)
+	{
+		if (!(program->planes & (1 << p)))
+			continue;
+
+		for (int i = 0; i < height; i++)
+		{
+			uint64_t* line = program->display[p][i];
+			if (program->hires)
+				line[1] = (line[1] >> 4) | (line[0] << 60);
+			line[0] >>= 4;
+		}
+	}
+	program->dirty_rows |= program_display_mask(program);
+
+	program->events |= k_program_event_draw;
+}
+
+// 00FC - scroll left 4 pixels
+static void program_op_scl(program_t* program, const program_op_t* op)
+{
+	int height = program_display_height(program);
+
+	for (int p = 0; p < PROGRAM_DISPLAY_PLANES; p++)
+	{
+		if (!(program->planes & (1 << p)))
+			continue;
+
+		for (int i = 0; i < height; i++)
+		{
+			uint64_t* line = program->display[p][i];
+			line[0] <<= 4;
+			if (program->hires)
+			{
+				line[0] |= line[1] >> 60;
+				line[1] <<= 4;
+			}
+		}
+	}
+	program->dirty_rows |= program_display_mask(program);
+
+	program->events |= k_program_event_draw;
+}
+
+// 00FD - exit the interpreter
+// The instruction repeats, so the machine stays halted here.
+static void program_op_exit(program_t* program, const program_op_t* op)
+{
+	program->pc -= 2;
+	program->events |= k_program_event_exit;
+}
+
+// 00FE - 64 x 32 mode; clears every plane
+static void program_op_low(program_t* program, const program_op_t* op)
+{
+	program->hires = false;
+	memset(program->display, 0, sizeof(program->display));
+	program->dirty_rows = ~0ULL;
+
+	program->events |= k_program_event_draw;
+}
+
+// 00FF - 128 x 64 mode; clears every plane
+static void program_op_high(program_t* program, const program_op_t* op)
+{
+	program->hires = true;
+	memset(program->display, 0, sizeof(program->display));
+	program->dirty_rows = ~0ULL;
+
+	program->events |= k_program_event_draw;
+}
+
+// FX30 - I = large font character VX
+static void program_op_ld_hf_vx(program_t* program, const program_op_t* op)
+{
+	program->index = PROGRAM_BIG_FONT_ADDR + (program->vars[op->x] & 0xF) * 10;
+}
+
+// FX75 - store V0 through VX in the flag registers
+static void program_op_ld_r_vx(program_t* program, const program_op_t* op)
+{
+	memcpy(program->rpl, program->vars, op->x + 1);
+}
+
+// FX85 - load V0 through VX from the flag registers
+static void program_op_ld_vx_r(program_t* program, const program_op_t* op)
+{
+	memcpy(program->vars, program->rpl, op->x + 1);
+}
+
+// XO-CHIP handlers
+
+// 00DN - scroll up N rows
+static void program_op_scu(program_t* program, const program_op_t* op)
+{
+	int height = program_display_height(program);
+	int n = op->n < height ? op->n : height;
+
+	for (int p = 0; p < PROGRAM_DISPLAY_PLANES; p++)
+	{
+		if (!(program->planes & (1 << p)))
+			continue;
+
+		memmove(program->display[p][0], program->display[p][n], sizeof(program->display[p][0]) * (height - n));
+		memset(program->display[p][height - n], 0, sizeof(program->display[p][0]) * n);
+	}
+	program->dirty_rows |= program_display_mask(program);
+
+	program->events |= k_program_event_draw;
+}
+
+// 5XY2 - store VX through VY at I, in either direction; I is unchanged
+static void program_op_save_vx_vy(program_t* program, const program_op_t* op)
+{
+	int step = op->x <= op->y ? 1 : -1;
+	int count = (op->x <= op->y ? op->y - op->x : op->x - op->y) + 1;
+
+	for (int i = 0; i < count; i++)
+		program->memory[(program->index + i) & (PROGRAM_MEMORY_MAX - 1)] = program->vars[op->x + i * step];
+
+	program_invalidate(program, program->index, count);
+}
+
+// 5XY3 - load VX through VY from I, in either direction; I is unchanged
+static void program_op_load_vx_vy(program_t* program, const program_op_t* op)
+{
+	int step = op->x <= op->y ? 1 : -1;
+	int count = (op->x <= op->y ? op->y - op->x : op->x - op->y) + 1;
+
+	for (int i = 0; i < count; i++)
+		program->vars[op->x + i * step] = program->memory[(program->index + i) & (PROGRAM_MEMORY_MAX - 1)];
+}
+
+// F000 NNNN - I = NNNN, read from the word after the instruction
+static void program_op_ld_i_long(program_t* program, const program_op_t* op)
+{
+	program->index = program->memory[program->pc] << 8 | program->memory[(uint16_t)(program->pc + 1)];
+	program->pc += 2;
+}
+
+// FN01 - select the planes drawn to, cleared and scrolled
+static void program_op_plane(program_t* program, const program_op_t* op)
+{
+	program->planes = op->x & 3;
+}
+
+// F002 - load the 16-byte audio pattern from I
+static void program_op_audio(program_t* program, const program_op_t* op)
+{
+	for (int i = 0; i < 16; i++)
+		program->pattern[i] = program->memory[(uint16_t)(program->index + i)];
+}
+
+// FX3A - pattern playback pitch = VX
+static void program_op_pitch(program_t* program, const program_op_t* op)
+{
+	program->pitch = program->vars[op->x];
+}
+
+// Per-platform instantiations of the quirk-dependent handlers
+#define PROGRAM_QUIRK_HANDLER(name, platform) \
+	static void program_op_##name##_##platform(program_t* program, const program_op_t* op) \
+	{ \
+		program_op_##name##_impl(program, op, &k_quirks_##platform); \
+	}
+
+#define PROGRAM_QUIRK_HANDLERS(platform) \
+	PROGRAM_QUIRK_HANDLER(se_vx_nn, platform) \
+	PROGRAM_QUIRK_HANDLER(sne_vx_nn, platform) \
+	PROGRAM_QUIRK_HANDLER(se_vx_vy, platform) \
+	PROGRAM_QUIRK_HANDLER(or, platform) \
+	PROGRAM_QUIRK_HANDLER(and, platform) \
+	PROGRAM_QUIRK_HANDLER(xor, platform) \
+	PROGRAM_QUIRK_HANDLER(shr, platform) \
+	PROGRAM_QUIRK_HANDLER(shl, platform) \
+	PROGRAM_QUIRK_HANDLER(sne_vx_vy, platform) \
+	PROGRAM_QUIRK_HANDLER(jp_v0, platform) \
+	PROGRAM_QUIRK_HANDLER(drw, platform) \
+	PROGRAM_QUIRK_HANDLER(skp, platform) \
+	PROGRAM_QUIRK_HANDLER(sknp, platform) \
+	PROGRAM_QUIRK_HANDLER(ld_b_vx, platform) \
+	PROGRAM_QUIRK_HANDLER(ld_i_vx, platform) \
+	PROGRAM_QUIRK_HANDLER(ld_vx_i, platform)
+
+PROGRAM_QUIRK_HANDLERS(chip8)
+PROGRAM_QUIRK_HANDLERS(schip)
+PROGRAM_QUIRK_HANDLERS(xochip)
+
+// SUPER-CHIP instructions, which XO-CHIP keeps: 00xx ones are machine code calls on CHIP-8, the
+// rest are unknown. XO-CHIP's own instructions follow the same rule on the other platforms.
+#define PROGRAM_SCHIP_chip8(handler, fallback) fallback
+#define PROGRAM_SCHIP_schip(handler, fallback) handler
+#define PROGRAM_SCHIP_xochip(handler, fallback) handler
+
+#define PROGRAM_XOCHIP_chip8(handler, fallback) fallback
+#define PROGRAM_XOCHIP_schip(handler, fallback) fallback
+#define PROGRAM_XOCHIP_xochip(handler, fallback) handler
+
+#define PROGRAM_HANDLER_TABLE(platform) \
+	static const program_handler_t program_handlers_##platform[k_op_count] = \
+	{ \
+		[k_op_unknown] = program_op_unknown, \
+		[k_op_sys] = program_op_sys, \
+		[k_op_cls] = program_op_cls, \
+		[k_op_ret] = program_op_ret, \
+		[k_op_jp] = program_op_jp, \
+		[k_op_call] = program_op_call, \
+		[k_op_se_vx_nn] = program_op_se_vx_nn_##platform, \
+		[k_op_sne_vx_nn] = program_op_sne_vx_nn_##platform, \
+		[k_op_se_vx_vy] = program_op_se_vx_vy_##platform, \
+		[k_op_ld_vx_nn] = program_op_ld_vx_nn, \
+		[k_op_add_vx_nn] = program_op_add_vx_nn, \
+		[k_op_ld_vx_vy] = program_op_ld_vx_vy, \
+		[k_op_or] = program_op_or_##platform, \
+		[k_op_and] = program_op_and_##platform, \
+		[k_op_xor] = program_op_xor_##platform, \
+		[k_op_add_vx_vy] = program_op_add_vx_vy, \
+		[k_op_sub] = program_op_sub, \
+		[k_op_shr] = program_op_shr_##platform, \
+		[k_op_subn] = program_op_subn, \
+		[k_op_shl] = program_op_shl_##platform, \
+		[k_op_sne_vx_vy] = program_op_sne_vx_vy_##platform, \
+		[k_op_ld_i] = program_op_ld_i, \
+		[k_op_jp_v0] = program_op_jp_v0_##platform, \
+		[k_op_rnd] = program_op_rnd, \
+		[k_op_drw] = program_op_drw_##platform, \
+		[k_op_skp] = program_op_skp_##platform, \
+		[k_op_sknp] = program_op_sknp_##platform, \
+		[k_op_ld_vx_dt] = program_op_ld_vx_dt, \
+		[k_op_ld_vx_k] = program_op_ld_vx_k, \
+		[k_op_ld_dt_vx] = program_op_ld_dt_vx, \
+		[k_op_ld_st_vx] = program_op_ld_st_vx, \
+		[k_op_add_i_vx] = program_op_add_i_vx, \
+		[k_op_ld_f_vx] = program_op_ld_f_vx, \
+		[k_op_ld_b_vx] = program_op_ld_b_vx_##platform, \
+		[k_op_ld_i_vx] = program_op_ld_i_vx_##platform, \
+		[k_op_ld_vx_i] = program_op_ld_vx_i_##platform, \
+		[k_op_scd] = PROGRAM_SCHIP_##platform(program_op_scd, program_op_sys), \
+		[k_op_scr] = PROGRAM_SCHIP_##platform(program_op_scr, program_op_sys), \
+		[k_op_scl] = PROGRAM_SCHIP_##platform(program_op_scl, program_op_sys), \
+		[k_op_exit] = PROGRAM_SCHIP_##platform(program_op_exit, program_op_sys), \
+		[k_op_low] = PROGRAM_SCHIP_##platform(program_op_low, program_op_sys), \
+		[k_op_high] = PROGRAM_SCHIP_##platform(program_op_high, program_op_sys), \
+		[k_op_ld_hf_vx] = PROGRAM_SCHIP_##platform(program_op_ld_hf_vx, program_op_unknown), \
+		[k_op_ld_r_vx] = PROGRAM_SCHIP_##platform(program_op_ld_r_vx, program_op_unknown), \
+		[k_op_ld_vx_r] = PROGRAM_SCHIP_##platform(program_op_ld_vx_r, program_op_unknown), \
+		[k_op_scu] = PROGRAM_XOCHIP_##platform(program_op_scu, program_op_sys), \
+		[k_op_save_vx_vy] = PROGRAM_XOCHIP_##platform(program_op_save_vx_vy, program_op_unknown), \
+		[k_op_load_vx_vy] = PROGRAM_XOCHIP_##platform(program_op_load_vx_vy, program_op_unknown), \
+		[k_op_ld_i_long] = PROGRAM_XOCHIP_##platform(program_op_ld_i_long, program_op_unknown), \
+		[k_op_plane] = PROGRAM_XOCHIP_##platform(program_op_plane, program_op_unknown), \
+		[k_op_audio] = PROGRAM_XOCHIP_##platform(program_op_audio, program_op_unknown), \
+		[k_op_pitch] = PROGRAM_XOCHIP_##platform(program_op_pitch, program_op_unknown), \
+	};
+
+PROGRAM_HANDLER_TABLE(chip8)
+PROGRAM_HANDLER_TABLE(schip)
+PROGRAM_HANDLER_TABLE(xochip)
+
+bool program_handler_unimplemented(program_handler_t handler)
+{
+	return handler == program_op_unknown || handler == program_op_sys;
+}
+
+const program_handler_t* program_platform_handlers(program_platform_t platform)
+{
+	switch (platform)
+	{
+	case k_program_platform_schip:
+		return program_handlers_schip;
+	case k_program_platform_xochip:
+		return program_handlers_xochip;
+	default:
+		return program_handlers_chip8;
+	}
+}
+
+// Decodes a single opcode into its kind and operand fields. The handler comes from the platform.
+static program_op_t program_decode(uint16_t instruction)
+{
+	program_op_t op =
+	{
+		.handler = NULL,
+		.nnn = instruction & 0x0FFF,
+		.x = (instruction & 0x0F00) >> 8,
+		.y = (instruction & 0x00F0) >> 4,
+		.n = instruction & 0x000F,
+		.nn = instruction & 0x00FF,
+		.kind = k_op_unknown,
+		.flags = 0,
+	};
+
+	switch (instruction & 0xF000)
+	{
+	case 0x0000:
+		switch (instruction)
+		{
+		case 0x00E0: op.kind = k_op_cls; break;
+		case 0x00EE: op.kind = k_op_ret; break;
+		case 0x00FB: op.kind = k_op_scr; break;
+		case 0x00FC: op.kind = k_op_scl; break;
+		case 0x00FD: op.kind = k_op_exit; break;
+		case 0x00FE: op.kind = k_op_low; break;
+		case 0x00FF: op.kind = k_op_high; break;
+		default:
+			if ((instruction & 0xFFF0) == 0x00C0)
+				op.kind = k_op_scd;
+			else if ((instruction & 0xFFF0) == 0x00D0)
+				op.kind = k_op_scu;
+			else
+				op.kind = k_op_sys;
+			break;
+		}
+		break;
+	case 0x1000: op.kind = k_op_jp; break;
+	case 0x2000: op.kind = k_op_call; break;
+	case 0x3000: op.kind = k_op_se_vx_nn; break;
+	case 0x4000: op.kind = k_op_sne_vx_nn; break;
+	case 0x5000:
+		if (op.n == 0)
+			op.kind = k_op_se_vx_vy;
+		else if (op.n == 2)
+			op.kind = k_op_save_vx_vy;
+		else if (op.n == 3)
+			op.kind = k_op_load_vx_vy;
+		break;
+	case 0x6000: op.kind = k_op_ld_vx_nn; break;
+	case 0x7000: op.kind = k_op_add_vx_nn; break;
+	case 0x8000:
+	{
+		// Indexed by N; gaps are unknown instructions
+		static const uint8_t alu[16] =
+		{
+			[0x0] = k_op_ld_vx_vy,
+			[0x1] = k_op_or,
+			[0x2] = k_op_and,
+			[0x3] = k_op_xor,
+			[0x4] = k_op_add_vx_vy,
+			[0x5] = k_op_sub,
+			[0x6] = k_op_shr,
+			[0x7] = k_op_subn,
+			[0xE] = k_op_shl,
+		};
+
+		op.kind = alu[op.n];
+		break;
+	}
+	case 0x9000: op.kind = op.n == 0 ? k_op_sne_vx_vy : k_op_unknown; break;
+	case 0xA000: op.kind = k_op_ld_i; break;
+	case 0xB000: op.kind = k_op_jp_v0; break;
+	case 0xC000: op.kind = k_op_rnd; break;
+	case 0xD000: op.kind = k_op_drw; break;
+	case 0xE000:
+		if (op.nn == 0x9E)
+			op.kind = k_op_skp;
+		else if (op.nn == 0xA1)
+			op.kind = k_op_sknp;
+		break;
+	case 0xF000:
+	{
+		switch (op.nn)
+		{
+		case 0x00: op.kind = instruction == 0xF000 ? k_op_ld_i_long : k_op_unknown; break;
+		case 0x01: op.kind = k_op_plane; break;
+		case 0x02: op.kind = instruction == 0xF002 ? k_op_audio : k_op_unknown; break;
+		case 0x07: op.kind = k_op_ld_vx_dt; break;
+		case 0x0A: op.kind = k_op_ld_vx_k; break;
+		case 0x15: op.kind = k_op_ld_dt_vx; break;
+		case 0x18: op.kind = k_op_ld_st_vx; break;
+		case 0x1E: op.kind = k_op_add_i_vx; break;
+		case 0x29: op.kind = k_op_ld_f_vx; break;
+		case 0x30: op.kind = k_op_ld_hf_vx; break;
+		case 0x33: op.kind = k_op_ld_b_vx; break;
+		case 0x3A: op.kind = k_op_pitch; break;
+		case 0x55: op.kind = k_op_ld_i_vx; break;
+		case 0x65: op.kind = k_op_ld_vx_i; break;
+		case 0x75: op.kind = k_op_ld_r_vx; break;
+		case 0x85: op.kind = k_op_ld_vx_r; break;
+		}
+		break;
+	}
+	}
+
+	// Anything that changes control flow, writes memory or raises an event ends its block. Kinds the
+	// platform doesn't implement are flagged when their block is built, from the platform's handler.
+	switch (op.kind)
+	{
+	case k_op_cls:
+	case k_op_ret:
+	case k_op_jp:
+	case k_op_call:
+	case k_op_se_vx_nn:
+	case k_op_sne_vx_nn:
+	case k_op_se_vx_vy:
+	case k_op_sne_vx_vy:
+	case k_op_jp_v0:
+	case k_op_drw:
+	case k_op_skp:
+	case k_op_sknp:
+	case k_op_ld_vx_k:
+	case k_op_ld_b_vx:
+	case k_op_ld_i_vx:
+	case k_op_scd:
+	case k_op_scr:
+	case k_op_scl:
+	case k_op_exit:
+	case k_op_low:
+	case k_op_high:
+	case k_op_scu:
+	case k_op_save_vx_vy:
+	case k_op_ld_i_long:
+		op.flags = k_op_flag_ends_block;
+		break;
+	default:
+		break;
+	}
+
+	return op;
+}
+
+// Builds the shared decode table. Called by program_init; safe to call more than once.
+void program_decode_init()
+{
+	if (program_decode_ready)
+		return;
+
+	for (uint32_t i = 0; i < 0x10000; i++)
+		program_decode_table[i] = program_decode((uint16_t)i);
+
+	program_decode_ready = true;
+}
@@ -0,0 +1,176 @@
+// Profiler
+// Reports the execution counts gathered by the interpreter loop.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "program.h"
+#include "program_internal.h"
+
+static const char* program_op_kind_names[k_op_count] =
+{
+	[k_op_unknown] = "unknown",
+	[k_op_sys] = "sys",
+	[k_op_cls] = "cls",
+	[k_op_ret] = "ret",
+	[k_op_jp] = "jp",
+	[k_op_call] = "call",
+	[k_op_se_vx_nn] = "se_vx_nn",
+	[k_op_sne_vx_nn] = "sne_vx_nn",
+	[k_op_se_vx_vy] = "se_vx_vy",
+	[k_op_ld_vx_nn] = "ld_vx_nn",
+	[k_op_add_vx_nn] = "add_vx_nn",
+	[k_op_ld_vx_vy] = "ld_vx_vy",
+	[k_op_or] = "or",
+	[k_op_and] = "and",
+	[k_op_xor] = "xor",
+	[k_op_add_vx_vy] = "add_vx_vy",
+	[k_op_sub] = "sub",
+	[k_op_shr] = "shr",
+	[k_op_subn] = "subn",
+	[k_op_shl] = "shl",
+	[k_op_sne_vx_vy] = "sne_vx_vy",
+	[k_op_ld_i] = "ld_i",
+	[k_op_jp_v0] = "jp_v0",
+	[k_op_rnd] = "rnd",
+	[k_op_drw] = "drw",
+	[k_op_skp] = "skp",
+	[k_op_sknp] = "sknp",
+	[k_op_ld_vx_dt] = "ld_vx_dt",
+	[k_op_ld_vx_k] = "ld_vx_k",
+	[k_op_ld_dt_vx] = "ld_dt_vx",
+	[k_op_ld_st_vx] = "ld_st_vx",
+	[k_op_add_i_vx] = "add_i_vx",
+	[k_op_ld_f_vx] = "ld_f_vx",
+	[k_op_ld_b_vx] = "ld_b_vx",
+	[k_op_ld_i_vx] = "ld_i_vx",
+	[k_op_ld_vx_i] = "ld_vx_i",
+	[k_op_scd] = "scd",
+	[k_op_scr] = "scr",
+	[k_op_scl] = "scl",
+	[k_op_exit] = "exit",
+	[k_op_low] = "low",
+	[k_op_high] = "high",
+	[k_op_ld_hf_vx] = "ld_hf_vx",
+	[k_op_ld_r_vx] = "ld_r_vx",
+	[k_op_ld_vx_r] = "ld_vx_r",
+	[k_op_scu] = "scu",
+	[k_op_save_vx_vy] = "save_vx_vy",
+	[k_op_load_vx_vy] = "load_vx_vy",
+	[k_op_ld_i_long] = "ld_i_long",
+	[k_op_plane] = "plane",
+	[k_op_audio] = "audio",
+	[k_op_pitch] = "pitch",
+};
+
+typedef struct program_profile_pc_t
+{
+	uint16_t pc;
+	uint64_t count;
+} program_profile_pc_t;
+
+bool program_set_profiling(program_t* program, bool enabled)
+{
+	if (!enabled)
+	{
+		free(program->profile);
+		program->profile = NULL;
+		return true;
+	}
+
+	size_t size = sizeof(program_profile_t) + sizeof(uint64_t) * program->memory_size;
+	if (program->profile == NULL)
+		program->profile = malloc(size);
+	if (program->profile == NULL)
+	{
+		fprintf(stderr, "Program: failed to allocate profile\n");
+		return false;
+	}
+
+	memset(program->profile, 0, size);
+	return true;
+}
+
+// Kind of the instruction currently in memory at the address.
+static const char* program_profile_kind_at(const program_t* program, uint16_t pc)
+{
+	uint16_t instruction = (program->memory[pc] << 8) | program->memory[(pc + 1) & (program->memory_size - 1)];
+	return program_op_kind_names[program_decode_table[instruction].kind];
+}
+
+static int program_profile_compare_pcs(const void* a, const void* b)
+{
+	const program_profile_pc_t* left = a;
+	const program_profile_pc_t* right = b;
+
+	if (left->count != right->count)
+		return left->count < right->count ? 1 : -1;
+	return left->pc - right->pc;
+}
+
+void program_profile_write_json(const program_t* program, FILE* out)
+{
+	const program_profile_t* profile = program->profile;
+	if (profile == NULL)
+	{
+		fprintf(out, "null\n");
+		return;
+	}
+
+	uint64_t total = 0;
+	for (int i = 0; i < k_op_count; i++)
+		total += profile->op_counts[i];
+
+	fprintf(out, "{\n  \"instructions\": %llu,\n  \"ops\": {", (unsigned long long)total);
+	for (int i = 0; i < k_op_count; i++)
+		fprintf(out, "%s\n    \"%s\": %llu", i ? "," : "", program_op_kind_names[i], (unsigned long long)profile->op_counts[i]);
+	fprintf(out, "\n  },\n");
+
+	// Hottest addresses first
+	program_profile_pc_t* pcs = malloc(sizeof(program_profile_pc_t) * program->memory_size);
+	size_t pc_count = 0;
+	for (uint32_t pc = 0; pcs && pc < program->memory_size; pc++)
+	{
+		if (profile->pc_counts[pc])
+			pcs[pc_count++] = (program_profile_pc_t){ .pc = (uint16_t)pc, .count = profile->pc_counts[pc] };
+	}
+	if (pcs)
+		qsort(pcs, pc_count, sizeof(program_profile_pc_t), program_profile_compare_pcs);
+
+	fprintf(out, "  \"pcs\": [");
+	for (size_t i = 0; i < pc_count; i++)
+	{
+		fprintf(out, "%s\n    { \"pc\": \"0x%03X\", \"op\": \"%s\", \"count\": %llu }",
+			i ? "," : "", pcs[i].pc, program_profile_kind_at(program, pcs[i].pc), (unsigned long long)pcs[i].count);
+	}
+	fprintf(out, "\n  ],\n");
+	free(pcs);
+
+	fprintf(out, "  \"draws\": {\n    \"count\": %llu,\n    \"max_gap\": %llu,\n    \"gaps\": [",
+		(unsigned long long)profile->draws, (unsigned long long)profile->draw_gap_max);
+	bool first = true;
+	for (int i = 0; i < PROGRAM_PROFILE_GAP_BUCKETS; i++)
+	{
+		if (profile->draw_gaps[i] == 0)
+			continue;
+
+		fprintf(out, "%s\n      { \"min\": %llu, \"max\": %llu, \"count\": %llu }",
+			first ? "" : ",", 1ULL << i, (2ULL << i) - 1, (unsigned long long)profile->draw_gaps[i]);
+		first = false;
+	}
+	fprintf(out, "\n    ]\n  }\n}\n");
+}
+
+void program_profile_write_folded(const program_t* program, FILE* out)
+{
+	const program_profile_t* profile = program->profile;
+	if (profile == NULL)
+		return;
+
+	for (uint32_t pc = 0; pc < program->memory_size; pc++)
+	{
+		if (profile->pc_counts[pc])
+			fprintf(out, "%s;0x%03X %llu\n", program_profile_kind_at(program, (uint16_t)pc), pc, (unsigned long long)profile->pc_counts[pc]);
+	}
+}
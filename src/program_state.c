@@ -0,0 +1,176 @@
+// Save states
+// Serializes the machine into a flat versioned blob. Multi-byte fields are little-endian so blobs
+// can move between hosts.
+
+#include <string.h>
+
+#include "program.h"
+#include "program_internal.h"
+
+#define PROGRAM_STATE_MAGIC "C8ST"
+#define PROGRAM_STATE_VERSION 8
+#define PROGRAM_STATE_PAGE 256 // Memory is compared, copied and invalidated in pages of this many bytes on load
+
+// Blob layout
+enum
+{
+	k_state_magic = 0,			  // 4 bytes
+	k_state_version = 4,		  // u16
+	k_state_platform = 6,		  // u8
+	k_state_hires = 7,			  // u8
+	k_state_rng = 8,			  // u32
+	k_state_pc = 12,			  // u16
+	k_state_index = 14,			  // u16
+	k_state_stack = 16,			  // 16 x u16
+	k_state_sp = 48,			  // u8
+	k_state_delay_timer = 49,	  // u8
+	k_state_sound_timer = 50,	  // u8
+	k_state_planes = 51,		  // u8
+	k_state_vars = 52,			  // 16 x u8
+	k_state_keys = 68,			  // u16
+	k_state_pitch = 70,			  // u8
+	k_state_key_wait = 71,		  // u8
+	k_state_rpl = 72,			  // 16 x u8
+	k_state_pattern = 88,		  // 16 x u8
+	k_state_key_releases = 104,	  // u16
+	k_state_loaded = 106,		  // u8
+	k_state_beeping = 107,		  // u8
+	k_state_rom_hash = 108,		  // u64
+	k_state_display = 116,		  // 2 planes x 64 rows x 2 x u64
+	k_state_memory = k_state_display + PROGRAM_DISPLAY_PLANES * PROGRAM_DISPLAY_ROWS * PROGRAM_DISPLAY_WORDS * 8, // Memory size of the platform
+};
+
+
+static void program_state_put16(uint8_t* dest, uint16_t value)
+{
+	dest[0] = value & 0xFF;
+	dest[1] = value >> 8;
+}
+
+static uint16_t program_state_get16(const uint8_t* src)
+{
+	return src[0] | (src[1] << 8);
+}
+
+static void program_state_put32(uint8_t* dest, uint32_t value)
+{
+	program_state_put16(dest, value & 0xFFFF);
+	program_state_put16(dest + 2, value >> 16);
+}
+
+static uint32_t program_state_get32(const uint8_t* src)
+{
+	return program_state_get16(src) | ((uint32_t)program_state_get16(src + 2) << 16);
+}
+
+static void program_state_put64(uint8_t* dest, uint64_t value)
+{
+	program_state_put32(dest, value & 0xFFFFFFFF);
+	program_state_put32(dest + 4, value >> 32);
+}
+
+static uint64_t program_state_get64(const uint8_t* src)
+{
+	return program_state_get32(src) | ((uint64_t)program_state_get32(src + 4) << 32);
+}
+
+size_t program_state_size(const program_t* program)
+{
+	return k_state_memory + program->memory_size;
+}
+
+size_t program_save_state(const program_t* program, void* buffer, size_t capacity)
+{
+	size_t size = program_state_size(program);
+	if (capacity < size)
+		return 0;
+
+	uint8_t* state = buffer;
+	memset(state, 0, k_state_memory);
+
+	memcpy(state + k_state_magic, PROGRAM_STATE_MAGIC, 4);
+	program_state_put16(state + k_state_version, PROGRAM_STATE_VERSION);
+	state[k_state_platform] = program->platform;
+	state[k_state_hires] = program->hires;
+	program_state_put32(state + k_state_rng, program->rng);
+	program_state_put16(state + k_state_pc, program->pc);
+	program_state_put16(state + k_state_index, program->index);
+	for (int i = 0; i < 16; i++)
+		program_state_put16(state + k_state_stack + i * 2, program->stack[i]);
+	state[k_state_sp] = program->sp;
+	state[k_state_delay_timer] = program->delay_timer;
+	state[k_state_sound_timer] = program->sound_timer;
+	memcpy(state + k_state_vars, program->vars, 16);
+	program_state_put16(state + k_state_keys, program->keys);
+	memcpy(state + k_state_rpl, program->rpl, 16);
+	state[k_state_planes] = program->planes;
+	state[k_state_pitch] = program->pitch;
+	state[k_state_key_wait] = program->key_wait;
+	program_state_put16(state + k_state_key_releases, program->key_releases);
+	state[k_state_loaded] = program->prog_loaded;
+	state[k_state_beeping] = program->beeping;
+	program_state_put64(state + k_state_rom_hash, program->rom_hash);
+	memcpy(state + k_state_pattern, program->pattern, sizeof(program->pattern));
+	uint8_t* display = state + k_state_display;
+	for (int p = 0; p < PROGRAM_DISPLAY_PLANES; p++)
+		for (int i = 0; i < PROGRAM_DISPLAY_ROWS; i++)
+			for (int w = 0; w < PROGRAM_DISPLAY_WORDS; w++, display += 8)
+				program_state_put64(display, program->display[p][i][w]);
+	memcpy(state + k_state_memory, program->memory, program->memory_size);
+
+	return size;
+}
+
+bool program_load_state(program_t* program, const void* buffer, size_t size)
+{
+	const uint8_t* state = buffer;
+
+	if (size < program_state_size(program)
+		|| memcmp(state + k_state_magic, PROGRAM_STATE_MAGIC, 4) != 0
+		|| program_state_get16(state + k_state_version) != PROGRAM_STATE_VERSION
+		|| state[k_state_platform] != program->platform)
+		return false;
+
+	program->hires = state[k_state_hires] != 0;
+	program->rng = program_state_get32(state + k_state_rng);
+	program->pc = program_state_get16(state + k_state_pc);
+	program->index = program_state_get16(state + k_state_index);
+	for (int i = 0; i < 16; i++)
+		program->stack[i] = program_state_get16(state + k_state_stack + i * 2);
+	program->sp = state[k_state_sp] > 16 ? 16 : state[k_state_sp];
+	program->delay_timer = state[k_state_delay_timer];
+	program->sound_timer = state[k_state_sound_timer];
+	memcpy(program->vars, state + k_state_vars, 16);
+	program->keys = program_state_get16(state + k_state_keys);
+	memcpy(program->rpl, state + k_state_rpl, 16);
+	program->planes = state[k_state_planes] & 3;
+	program->pitch = state[k_state_pitch];
+	program->key_wait = state[k_state_key_wait] != 0;
+	program->key_releases = program_state_get16(state + k_state_key_releases);
+	memcpy(program->pattern, state + k_state_pattern, sizeof(program->pattern));
+	program->beeping = state[k_state_beeping] != 0;
+	program->rom_hash = program_state_get64(state + k_state_rom_hash);
+	const uint8_t* display = state + k_state_display;
+	for (int p = 0; p < PROGRAM_DISPLAY_PLANES; p++)
+		for (int i = 0; i < PROGRAM_DISPLAY_ROWS; i++)
+			for (int w = 0; w < PROGRAM_DISPLAY_WORDS; w++, display += 8)
+				program->display[p][i][w] = program_state_get64(display);
+
+	// States a frame or so apart differ in a few bytes of data, so only the pages that differ are
+	// copied, and only cached code inside them is dropped
+	const uint8_t* memory = state + k_state_memory;
+	for (uint32_t page = 0; page < program->memory_size; page += PROGRAM_STATE_PAGE)
+	{
+		if (memcmp(program->memory + page, memory + page, PROGRAM_STATE_PAGE) != 0)
+		{
+			memcpy(program->memory + page, memory + page, PROGRAM_STATE_PAGE);
+			program_invalidate(program, (uint16_t)page, PROGRAM_STATE_PAGE);
+		}
+	}
+
+	program->events = 0;
+	program->dirty_rows = ~0ULL;
+	program->prog_loaded = state[k_state_loaded] != 0;
+
+	return true;
+}
@@ -0,0 +1,237 @@
+// Replay
+// Records and plays back per-frame keypad state.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "replay.h"
+
+#define REPLAY_MAGIC "C8RP"
+#define REPLAY_VERSION 2
+#define REPLAY_HEADER_SIZE 24
+#define REPLAY_RECORD_SIZE 6
+
+typedef struct replay_event_t
+{
+	uint32_t frame;
+	uint16_t keys;
+} replay_event_t;
+
+typedef struct replay_t
+{
+	FILE* file;			  // Open while recording
+	uint64_t ips;
+	program_platform_t platform;
+	uint64_t rom_hash;
+
+	// Recording
+	bool recorded;		  // At least one event written
+	uint32_t last_frame;
+	uint16_t last_keys;
+
+	// Playback
+	replay_event_t* events;
+	size_t event_count;	  // Key changes, not counting the end marker
+	size_t cursor;		  // Last event at or before the frame most recently read
+	uint32_t frames;
+} replay_t;
+
+static void replay_write_event(FILE* file, uint32_t frame, uint16_t keys)
+{
+	uint8_t record[REPLAY_RECORD_SIZE] =
+	{
+		frame & 0xFF, (frame >> 8) & 0xFF, (frame >> 16) & 0xFF, frame >> 24,
+		keys & 0xFF, keys >> 8,
+	};
+
+	fwrite(record, 1, sizeof(record), file);
+}
+
+replay_t* replay_record(const char* path, uint64_t ips, const program_t* program)
+{
+	if (ips == 0 || ips > UINT32_MAX)
+	{
+		fprintf(stderr, "Replay: recording needs a fixed instruction rate\n");
+		return NULL;
+	}
+
+	replay_t* replay = calloc(1, sizeof(replay_t));
+	if (replay == NULL)
+	{
+		fprintf(stderr, "Replay: failed to allocate memory for object\n");
+		return NULL;
+	}
+
+	replay->file = fopen(path, "wb");
+	if (replay->file == NULL)
+	{
+		fprintf(stderr, "Replay: couldn't open %s for writing\n", path);
+		free(replay);
+		return NULL;
+	}
+
+	replay->ips = ips;
+	replay->platform = program_platform(program);
+	replay->rom_hash = program_rom_hash(program);
+
+	uint8_t header[REPLAY_HEADER_SIZE] = { 0 };
+	memcpy(header, REPLAY_MAGIC, 4);
+	header[4] = REPLAY_VERSION & 0xFF;
+	header[5] = REPLAY_VERSION >> 8;
+	header[6] = (uint8_t)replay->platform;
+	for (int i = 0; i < 4; i++)
+		header[8 + i] = (uint8_t)(ips >> (i * 8));
+	for (int i = 0; i < 8; i++)
+		header[16 + i] = (uint8_t)(replay->rom_hash >> (i * 8));
+	fwrite(header, 1, sizeof(header), replay->file);
+
+	return replay;
+}
+
+void replay_record_keys(replay_t* replay, uint32_t frame, uint16_t keys)
+{
+	// Frame 0 always gets an event, so playback never has to assume the starting keys
+	if (!replay->recorded || keys != replay->last_keys)
+		replay_write_event(replay->file, frame, keys);
+
+	replay->recorded = true;
+	replay->last_frame = frame;
+	replay->last_keys = keys;
+}
+
+replay_t* replay_open(const char* path)
+{
+	FILE* file = fopen(path, "rb");
+	if (file == NULL)
+	{
+		fprintf(stderr, "Replay: couldn't open %s\n", path);
+		return NULL;
+	}
+
+	replay_t* replay = calloc(1, sizeof(replay_t));
+	uint8_t header[REPLAY_HEADER_SIZE];
+
+	if (replay == NULL
+		|| fread(header, 1, sizeof(header), file) != sizeof(header)
+		|| memcmp(header, REPLAY_MAGIC, 4) != 0
+		|| (header[4] | (header[5] << 8)) != REPLAY_VERSION
+		|| header[6] >= k_program_platform_count)
+	{
+		fprintf(stderr, "Replay: %s isn't a version %d replay\n", path, REPLAY_VERSION);
+		fclose(file);
+		free(replay);
+		return NULL;
+	}
+
+	replay->platform = (program_platform_t)header[6];
+	for (int i = 0; i < 4; i++)
+		replay->ips |= (uint64_t)header[8 + i] << (i * 8);
+	for (int i = 0; i < 8; i++)
+		replay->rom_hash |= (uint64_t)header[16 + i] << (i * 8);
+
+	size_t capacity = 0;
+	uint8_t record[REPLAY_RECORD_SIZE];
+	while (fread(record, 1, sizeof(record), file) == sizeof(record))
+	{
+		if (replay->event_count == capacity)
+		{
+			capacity = capacity ? capacity * 2 : 256;
+			replay_event_t* events = realloc(replay->events, sizeof(replay_event_t) * capacity);
+			if (events == NULL)
+			{
+				fprintf(stderr, "Replay: failed to allocate events for %s\n", path);
+				fclose(file);
+				replay_close(replay, 0);
+				return NULL;
+			}
+			replay->events = events;
+		}
+
+		replay_event_t* event = &replay->events[replay->event_count++];
+		event->frame = record[0] | (record[1] << 8) | (record[2] << 16) | ((uint32_t)record[3] << 24);
+		event->keys = record[4] | (record[5] << 8);
+	}
+
+	fclose(file);
+
+	if (replay->event_count < 2 || replay->ips == 0)
+	{
+		fprintf(stderr, "Replay: %s has no frames\n", path);
+		replay_close(replay, 0);
+		return NULL;
+	}
+
+	// The last record only marks the length
+	replay->event_count--;
+	replay->frames = replay->events[replay->event_count].frame;
+
+	return replay;
+}
+
+uint64_t replay_ips(const replay_t* replay)
+{
+	return replay->ips;
+}
+
+program_platform_t replay_platform(const replay_t* replay)
+{
+	return replay->platform;
+}
+
+bool replay_matches(const replay_t* replay, const program_t* program)
+{
+	return program_platform(program) == replay->platform && program_rom_hash(program) == replay->rom_hash;
+}
+
+uint32_t replay_frames(const replay_t* replay)
+{
+	return replay->frames;
+}
+
+uint16_t replay_keys(replay_t* replay, uint32_t frame)
+{
+	if (replay->event_count == 0)
+		return 0;
+
+	if (replay->cursor >= replay->event_count || replay->events[replay->cursor].frame > frame)
+		replay->cursor = 0;
+
+	while (replay->cursor + 1 < replay->event_count && replay->events[replay->cursor + 1].frame <= frame)
+		replay->cursor++;
+
+	return replay->events[replay->cursor].frame <= frame ? replay->events[replay->cursor].keys : 0;
+}
+
+uint16_t replay_keys_at(const replay_t* replay, uint32_t frame)
+{
+	// First event after the frame; the one before it holds the keys
+	size_t lo = 0, hi = replay->event_count;
+	while (lo < hi)
+	{
+		size_t mid = lo + (hi - lo) / 2;
+		if (replay->events[mid].frame <= frame)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo > 0 ? replay->events[lo - 1].keys : 0;
+}
+
+void replay_close(replay_t* replay, uint32_t frames)
+{
+	if (replay == NULL)
+		return;
+
+	if (replay->file)
+	{
+		if (!replay->recorded)
+			replay_write_event(replay->file, 0, 0);
+		replay_write_event(replay->file, frames, replay->last_keys);
+		fclose(replay->file);
+	}
+
+	free(replay->events);
+	free(replay);
+}
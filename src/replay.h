@@ -0,0 +1,50 @@
+#pragma once
+
+// Input replays. A replay holds the platform, the ROM it was recorded with, the instruction rate and
+// the keypad state of every frame, stored as the frames where it changed, so a ROM can be rerun bit
+// for bit without a window.
+//
+// File layout, little-endian:
+//   "C8RP", u16 version, u8 platform, u8 reserved, u32 instructions per second, u32 reserved,
+//   u64 ROM hash (program_rom_hash)
+//   { u32 frame, u16 keys } for each change of keys, in frame order
+//   { u32 frame, u16 keys } marking the end: the frame count, with the last keys repeated
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "program.h"
+
+typedef struct replay_t replay_t;
+
+// Starts recording the given program to the given file. The rate must be fixed (not
+// SCHEDULER_UNLIMITED), since frames only have a reproducible number of instructions at a fixed rate.
+replay_t* replay_record(const char* path, uint64_t ips, const program_t* program);
+
+// Records the keys held during the given frame. Frames must be given in increasing order; frames
+// that aren't given keep the previous keys.
+void replay_record_keys(replay_t* replay, uint32_t frame, uint16_t keys);
+
+// Loads a replay for playback. Returns NULL if the file isn't a valid replay.
+replay_t* replay_open(const char* path);
+
+uint64_t replay_ips(const replay_t* replay);
+
+program_platform_t replay_platform(const replay_t* replay);
+
+// True if the program runs on the replay's platform with the ROM it was recorded with. Played back
+// against anything else, the keys mean nothing.
+bool replay_matches(const replay_t* replay, const program_t* program);
+
+// Number of frames the replay covers.
+uint32_t replay_frames(const replay_t* replay);
+
+// Keys held during the given frame. Fastest when frames are read in increasing order.
+uint16_t replay_keys(replay_t* replay, uint32_t frame);
+
+// Like replay_keys, but reads nothing but the events, by binary search, so one replay can be shared
+// by any number of threads.
+uint16_t replay_keys_at(const replay_t* replay, uint32_t frame);
+
+// Finishes the file (when recording, frames is the number of frames run) and frees the replay.
+void replay_close(replay_t* replay, uint32_t frames);
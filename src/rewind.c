@@ -0,0 +1,282 @@
+// Rewind
+// Ring of per-frame save states. Frames are stored in a byte pool in the order they're recorded;
+// a keyframe is a raw state, every other frame is its XOR against the latest keyframe, encoded as
+// (u16 equal bytes, u16 changed bytes, changed bytes XOR keyframe) tokens.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rewind.h"
+
+// Runs of at least this many unchanged bytes end a literal run
+#define REWIND_MIN_RUN 4
+#define REWIND_MAX_RUN 0xFFFF
+
+typedef struct rewind_frame_t
+{
+	uint32_t offset;	  // Position in the pool
+	uint32_t size;		  // Bytes in the pool
+	uint64_t key;		  // Sequence number of the keyframe this frame is encoded against
+	bool keyframe;
+} rewind_frame_t;
+
+typedef struct rewind_t
+{
+	size_t state_size;
+	uint32_t max_frames;
+	uint32_t keyframe_interval;
+
+	rewind_frame_t* frames; // Indexed by sequence number modulo max_frames
+	uint64_t first;		  // Sequence number of the oldest frame held
+	uint64_t next;		  // Sequence number of the next frame recorded
+
+	uint8_t* pool;
+	size_t pool_size;
+	size_t write;		  // Where the next frame goes, unless it has to wrap
+
+	uint8_t* state;		  // Scratch state
+	uint8_t* delta;		  // Scratch encoding
+} rewind_t;
+
+rewind_t* rewind_init(const program_t* program, uint32_t max_frames, uint32_t keyframe_interval, size_t pool_size)
+{
+	size_t state_size = program_state_size(program);
+	if (max_frames == 0 || keyframe_interval == 0 || pool_size < state_size || pool_size > UINT32_MAX)
+	{
+		fprintf(stderr, "Rewind: pool of %zu bytes can't hold a %zu byte keyframe\n", pool_size, state_size);
+		return NULL;
+	}
+
+	rewind_t* rewind = calloc(1, sizeof(rewind_t));
+	if (rewind == NULL)
+	{
+		fprintf(stderr, "Rewind: failed to allocate memory for object\n");
+		return NULL;
+	}
+
+	rewind->state_size = state_size;
+	rewind->max_frames = max_frames;
+	rewind->keyframe_interval = keyframe_interval;
+	rewind->pool_size = pool_size;
+	rewind->frames = malloc(sizeof(rewind_frame_t) * max_frames);
+	rewind->pool = malloc(pool_size);
+	rewind->state = malloc(state_size);
+	rewind->delta = malloc(state_size);
+	if (rewind->frames == NULL || rewind->pool == NULL || rewind->state == NULL || rewind->delta == NULL)
+	{
+		fprintf(stderr, "Rewind: failed to allocate memory for object\n");
+		rewind_terminate(rewind);
+		return NULL;
+	}
+
+	return rewind;
+}
+
+void rewind_terminate(rewind_t* rewind)
+{
+	if (rewind == NULL)
+		return;
+
+	free(rewind->frames);
+	free(rewind->pool);
+	free(rewind->state);
+	free(rewind->delta);
+	free(rewind);
+}
+
+void rewind_clear(rewind_t* rewind)
+{
+	rewind->first = 0;
+	rewind->next = 0;
+	rewind->write = 0;
+}
+
+uint32_t rewind_frame_count(const rewind_t* rewind)
+{
+	return (uint32_t)(rewind->next - rewind->first);
+}
+
+static rewind_frame_t* rewind_frame(const rewind_t* rewind, uint64_t sequence)
+{
+	return &rewind->frames[sequence % rewind->max_frames];
+}
+
+// Drops the oldest keyframe and every frame encoded against it.
+static void rewind_evict(rewind_t* rewind)
+{
+	do
+		rewind->first++;
+	while (rewind->first < rewind->next && !rewind_frame(rewind, rewind->first)->keyframe);
+}
+
+// Reserves size contiguous bytes after the newest frame, evicting old frames until they fit.
+static uint32_t rewind_alloc(rewind_t* rewind, size_t size)
+{
+	for (;;)
+	{
+		if (rewind->first == rewind->next)
+		{
+			rewind->write = 0;
+			break;
+		}
+
+		size_t oldest = rewind_frame(rewind, rewind->first)->offset;
+		if (oldest >= rewind->write)
+		{
+			if (oldest - rewind->write >= size)
+				break;
+		}
+		else if (rewind->pool_size - rewind->write >= size)
+		{
+			break;
+		}
+		else if (oldest >= size)
+		{
+			rewind->write = 0;
+			break;
+		}
+
+		rewind_evict(rewind);
+	}
+
+	uint32_t offset = (uint32_t)rewind->write;
+	rewind->write += size;
+	return offset;
+}
+
+// Encodes the difference between a state and a keyframe. Returns the encoded size, or 0 if it
+// wouldn't be smaller than the state itself.
+static size_t rewind_encode(const uint8_t* state, const uint8_t* key, size_t size, uint8_t* out)
+{
+	size_t i = 0, used = 0;
+
+	while (i < size)
+	{
+		size_t equal = 0;
+		while (i < size && equal < REWIND_MAX_RUN && state[i] == key[i])
+		{
+			equal++;
+			i++;
+		}
+
+		size_t start = i;
+		while (i < size && i - start < REWIND_MAX_RUN - REWIND_MIN_RUN)
+		{
+			size_t run = 0;
+			while (i + run < size && run < REWIND_MIN_RUN && state[i + run] == key[i + run])
+				run++;
+
+			if (run == REWIND_MIN_RUN || i + run == size)
+				break;
+
+			i += run + 1;
+		}
+
+		size_t literals = i - start;
+		if (used + 4 + literals >= size)
+			return 0;
+
+		out[used++] = equal & 0xFF;
+		out[used++] = (uint8_t)(equal >> 8);
+		out[used++] = literals & 0xFF;
+		out[used++] = (uint8_t)(literals >> 8);
+		for (size_t j = start; j < i; j++)
+			out[used++] = state[j] ^ key[j];
+	}
+
+	return used;
+}
+
+// Applies an encoded difference to a copy of its keyframe.
+static void rewind_decode(const uint8_t* delta, size_t delta_size, uint8_t* state)
+{
+	size_t pos = 0;
+
+	for (size_t i = 0; i + 4 <= delta_size;)
+	{
+		pos += delta[i] | (delta[i + 1] << 8);
+		size_t literals = delta[i + 2] | (delta[i + 3] << 8);
+		i += 4;
+
+		for (size_t j = 0; j < literals; j++)
+			state[pos++] ^= delta[i++];
+	}
+}
+
+void rewind_push(rewind_t* rewind, const program_t* program)
+{
+	program_save_state(program, rewind->state, rewind->state_size);
+
+	if (rewind_frame_count(rewind) == rewind->max_frames)
+		rewind_evict(rewind);
+
+	const uint8_t* data = rewind->state;
+	size_t size = rewind->state_size;
+	uint64_t key = rewind->next;
+
+	if (rewind->first != rewind->next)
+	{
+		uint64_t latest_key = rewind_frame(rewind, rewind->next - 1)->key;
+		if (rewind->next - latest_key < rewind->keyframe_interval)
+		{
+			size_t delta_size = rewind_encode(rewind->state, rewind->pool + rewind_frame(rewind, latest_key)->offset, rewind->state_size, rewind->delta);
+			if (delta_size)
+			{
+				data = rewind->delta;
+				size = delta_size;
+				key = latest_key;
+			}
+		}
+	}
+
+	uint32_t offset = rewind_alloc(rewind, size);
+
+	// Making room evicts the keyframe only once the whole history is gone
+	if (key != rewind->next && rewind->first == rewind->next)
+	{
+		data = rewind->state;
+		size = rewind->state_size;
+		key = rewind->next;
+		offset = rewind_alloc(rewind, size);
+	}
+
+	memcpy(rewind->pool + offset, data, size);
+
+	rewind_frame_t* frame = rewind_frame(rewind, rewind->next);
+	frame->offset = offset;
+	frame->size = (uint32_t)size;
+	frame->key = key;
+	frame->keyframe = key == rewind->next;
+	rewind->next++;
+}
+
+bool rewind_restore(rewind_t* rewind, program_t* program, uint32_t age)
+{
+	if (age >= rewind_frame_count(rewind))
+		return false;
+
+	const rewind_frame_t* frame = rewind_frame(rewind, rewind->next - 1 - age);
+	const rewind_frame_t* key = rewind_frame(rewind, frame->key);
+
+	memcpy(rewind->state, rewind->pool + key->offset, rewind->state_size);
+	if (!frame->keyframe)
+		rewind_decode(rewind->pool + frame->offset, frame->size, rewind->state);
+
+	return program_load_state(program, rewind->state, rewind->state_size);
+}
+
+bool rewind_step_back(rewind_t* rewind, program_t* program)
+{
+	uint32_t count = rewind_frame_count(rewind);
+	if (count == 0)
+		return false;
+
+	if (count > 1)
+	{
+		rewind->next--;
+		rewind->write = rewind_frame(rewind, rewind->next)->offset;
+	}
+
+	return rewind_restore(rewind, program, 0);
+}
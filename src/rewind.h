@@ -0,0 +1,36 @@
+#pragma once
+
+// Rewind history. Keeps a ring of per-frame save states in a fixed amount of memory: every few
+// frames a full keyframe, and in between only the run-length encoded XOR against that keyframe.
+// When the pool fills up, the oldest keyframe is dropped together with the frames that depend on it.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "program.h"
+
+typedef struct rewind_t rewind_t;
+
+// Creates a history of up to max_frames frames stored in pool_size bytes, with a keyframe every
+// keyframe_interval frames. Returns NULL if the pool can't hold even one keyframe.
+rewind_t* rewind_init(const program_t* program, uint32_t max_frames, uint32_t keyframe_interval, size_t pool_size);
+
+void rewind_terminate(rewind_t* rewind);
+
+// Records the program's current state as the newest frame. Call once per emulated frame.
+void rewind_push(rewind_t* rewind, const program_t* program);
+
+// Number of frames currently held.
+uint32_t rewind_frame_count(const rewind_t* rewind);
+
+// Restores the frame recorded the given number of frames before the newest one (0 = newest),
+// leaving the history as it is. Returns false if it isn't held.
+bool rewind_restore(rewind_t* rewind, program_t* program, uint32_t age);
+
+// Drops the newest frame and restores the one before it, so repeated calls play the history
+// backwards. The oldest frame is never dropped. Returns false if the history is empty.
+bool rewind_step_back(rewind_t* rewind, program_t* program);
+
+// Discards every frame.
+void rewind_clear(rewind_t* rewind);
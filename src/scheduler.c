@@ -0,0 +1,248 @@
+// Scheduler
+// Paces the CPU and the 60 Hz timers against a monotonic clock.
+
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 199309L
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "scheduler.h"
+
+// Frames further behind than this are dropped instead of caught up (e.g. after a window drag)
+#define SCHEDULER_MAX_LAG_FRAMES 4
+
+// Instructions run between clock checks in unlimited mode
+#define SCHEDULER_UNLIMITED_CHUNK 4096
+
+typedef struct scheduler_t
+{
+	uint64_t ips;		  // Instructions per second (SCHEDULER_UNLIMITED = as many as fit)
+	uint64_t remainder;	  // Fractional instructions carried between frames, in 1/60ths
+	double next_frame;	  // Monotonic time the next frame is due
+	bool started;
+	bool suspended;		  // The program was idle at the last update; the clock is stopped
+	uint16_t keys;		  // Keys for the next frame
+	uint32_t frame;		  // Frames run
+	replay_t* replay;	  // Receives the keys of every frame run, if recording
+	scheduler_frame_hook_t frame_hook; // Called after every frame run, if set
+	void* frame_user;
+} scheduler_t;
+
+scheduler_t* scheduler_init(uint64_t ips)
+{
+	scheduler_t* scheduler = malloc(sizeof(scheduler_t));
+	if (scheduler == NULL)
+	{
+		fprintf(stderr, "Scheduler: failed to allocate memory for object\n");
+		return NULL;
+	}
+
+	scheduler->ips = ips;
+	scheduler->remainder = 0;
+	scheduler->next_frame = 0.0;
+	scheduler->started = false;
+	scheduler->suspended = false;
+	scheduler->keys = 0;
+	scheduler->frame = 0;
+	scheduler->replay = NULL;
+	scheduler->frame_hook = NULL;
+	scheduler->frame_user = NULL;
+
+	return scheduler;
+}
+
+void scheduler_set_speed(scheduler_t* scheduler, uint64_t ips)
+{
+	scheduler->ips = ips;
+	scheduler->remainder = 0;
+}
+
+void scheduler_set_keys(scheduler_t* scheduler, uint16_t keys)
+{
+	scheduler->keys = keys;
+}
+
+void scheduler_record(scheduler_t* scheduler, replay_t* replay)
+{
+	scheduler->replay = replay;
+}
+
+void scheduler_on_frame(scheduler_t* scheduler, scheduler_frame_hook_t hook, void* user)
+{
+	scheduler->frame_hook = hook;
+	scheduler->frame_user = user;
+}
+
+uint32_t scheduler_frame(const scheduler_t* scheduler)
+{
+	return scheduler->frame;
+}
+
+// Idle and with no new keys to wake it: a frame would change nothing, not even the keys held.
+static bool scheduler_idle(const scheduler_t* scheduler, const program_t* program)
+{
+	return program_idle(program) && program_keys(program) == scheduler->keys;
+}
+
+double scheduler_now()
+{
+#ifdef _WIN32
+	LARGE_INTEGER count, frequency;
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&frequency);
+	return (double)count.QuadPart / (double)frequency.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+// True if a run that stopped this way can't go on without input. Unknown instructions are skipped,
+// so an error only stops a run that made no progress at all (e.g. no program loaded).
+static bool scheduler_stalled(program_run_t run)
+{
+	return run.reason == k_program_stop_key_wait || run.reason == k_program_stop_exit || run.cycles == 0;
+}
+
+// Runs the given number of instructions, going on past errors, so a budget runs the same
+// instructions whether it's split into frames or not.
+static program_run_t scheduler_run_cycles(program_t* program, uint64_t cycles)
+{
+	program_run_t total = { .cycles = 0, .reason = k_program_stop_budget };
+
+	while (total.cycles < cycles)
+	{
+		program_run_t run = program_run_cycles(program, cycles - total.cycles);
+		total.cycles += run.cycles;
+		total.reason = run.reason;
+
+		if (scheduler_stalled(run))
+			break;
+	}
+
+	return total;
+}
+
+// Runs instructions until the given time in unlimited mode.
+static program_run_t scheduler_run_until_time(program_t* program, double deadline)
+{
+	program_run_t total = { .cycles = 0, .reason = k_program_stop_budget };
+
+	do
+	{
+		program_run_t run = scheduler_run_cycles(program, SCHEDULER_UNLIMITED_CHUNK);
+		total.cycles += run.cycles;
+		total.reason = run.reason;
+
+		if (run.cycles < SCHEDULER_UNLIMITED_CHUNK)
+			break;
+	} while (scheduler_now() < deadline);
+
+	return total;
+}
+
+program_run_t scheduler_step_frame(scheduler_t* scheduler, program_t* program)
+{
+	program_run_t run;
+
+	// Keys change only here, and a recording gets exactly the keys each frame ran with
+	program_set_keys(program, scheduler->keys);
+	if (scheduler->replay)
+		replay_record_keys(scheduler->replay, scheduler->frame, scheduler->keys);
+	scheduler->frame++;
+
+	if (scheduler->ips == SCHEDULER_UNLIMITED)
+	{
+		run = scheduler_run_until_time(program, scheduler->next_frame + 1.0 / SCHEDULER_FRAME_RATE);
+	}
+	else
+	{
+		// Spread the remainder of ips / 60 across frames so every second runs exactly ips
+		uint64_t total = scheduler->remainder + scheduler->ips;
+		scheduler->remainder = total % SCHEDULER_FRAME_RATE;
+		run = scheduler_run_cycles(program, total / SCHEDULER_FRAME_RATE);
+	}
+
+	program_tick_timers(program);
+	if (scheduler->frame_hook)
+		scheduler->frame_hook(program, scheduler->frame_user);
+
+	return run;
+}
+
+program_run_t scheduler_run_budget(scheduler_t* scheduler, program_t* program, uint64_t cycles, uint64_t frames)
+{
+	program_run_t total = { .cycles = 0, .reason = k_program_stop_budget };
+
+	if (frames)
+	{
+		for (uint64_t i = 0; i < frames; i++)
+		{
+			// Nothing can wake an idle program here, so the remaining frames would change nothing
+			if (scheduler_idle(scheduler, program))
+			{
+				total.reason = k_program_stop_key_wait;
+				break;
+			}
+
+			program_run_t run = scheduler_step_frame(scheduler, program);
+			total.cycles += run.cycles;
+			total.reason = run.reason;
+		}
+
+		return total;
+	}
+
+	return scheduler_run_cycles(program, cycles);
+}
+
+uint32_t scheduler_update(scheduler_t* scheduler, program_t* program, double now)
+{
+	const double period = 1.0 / SCHEDULER_FRAME_RATE;
+
+	if (!scheduler->started || now - scheduler->next_frame > period * SCHEDULER_MAX_LAG_FRAMES)
+	{
+		scheduler->next_frame = now;
+		scheduler->started = true;
+	}
+
+	// FX0A with the timers run down suspends the clock: frames would change nothing until new keys
+	// arrive, so none are run (or recorded), and the clock restarts from the update that brings them
+	uint32_t frames = 0;
+	scheduler->suspended = false;
+	while (now >= scheduler->next_frame)
+	{
+		if (scheduler_idle(scheduler, program))
+		{
+			scheduler->suspended = true;
+			scheduler->started = false;
+			break;
+		}
+
+		scheduler_step_frame(scheduler, program);
+		scheduler->next_frame += period;
+		frames++;
+	}
+
+	return frames;
+}
+
+bool scheduler_suspended(const scheduler_t* scheduler)
+{
+	return scheduler->suspended;
+}
+
+void scheduler_terminate(scheduler_t* scheduler)
+{
+	free(scheduler);
+}
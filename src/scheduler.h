@@ -0,0 +1,62 @@
+#pragma once
+
+// Emulation clock. Runs the CPU at a configurable rate and ticks the timers at 60 Hz, independent
+// of how often the host renders.
+
+#include <stdint.h>
+
+#include "program.h"
+#include "replay.h"
+
+#define SCHEDULER_FRAME_RATE 60
+#define SCHEDULER_UNLIMITED 0 // Instructions per second: run as many as fit in each frame
+#define SCHEDULER_DEFAULT_IPS 700 // Instructions per second the runners use unless told otherwise
+
+typedef struct scheduler_t scheduler_t;
+
+// Called after every frame the scheduler runs, once its timers have ticked.
+typedef void (*scheduler_frame_hook_t)(const program_t* program, void* user);
+
+// Creates a scheduler running at the given instructions per second (or SCHEDULER_UNLIMITED).
+scheduler_t* scheduler_init(uint64_t ips);
+
+void scheduler_set_speed(scheduler_t* scheduler, uint64_t ips);
+
+// Seconds from a monotonic clock.
+double scheduler_now();
+
+// Sets the keypad keys (bit n for key n) that the next frames run with. They only reach the program
+// at the start of a frame, so a run depends on nothing but the keys of each frame.
+void scheduler_set_keys(scheduler_t* scheduler, uint16_t keys);
+
+// Records the keys applied to every following frame to the replay, numbered from the frames run so
+// far. Pass NULL to stop.
+void scheduler_record(scheduler_t* scheduler, replay_t* replay);
+
+// Calls the hook after every following frame, e.g. to queue the frame's sound. An update can run
+// several frames, and each gets its own call. Pass NULL to stop.
+void scheduler_on_frame(scheduler_t* scheduler, scheduler_frame_hook_t hook, void* user);
+
+// Number of frames run so far.
+uint32_t scheduler_frame(const scheduler_t* scheduler);
+
+// Runs one 60 Hz frame: applies the keys, runs that frame's share of instructions, then ticks the
+// timers. With a fixed rate the instruction count depends only on the rate and the frame number,
+// so runs are reproducible. Errors don't end the frame early; only a key wait or an exit does.
+program_run_t scheduler_step_frame(scheduler_t* scheduler, program_t* program);
+
+// Runs a fixed budget without looking at the clock: the given number of frames, or if frames is 0,
+// the given number of instructions with the timers left alone. Used for reproducible offline runs.
+// Stops early with k_program_stop_key_wait once the program is idle (see program_idle).
+program_run_t scheduler_run_budget(scheduler_t* scheduler, program_t* program, uint64_t cycles, uint64_t frames);
+
+// Runs every frame that has come due by the given time. Returns the number of frames run. Frames
+// aren't run while the program is idle and the keys are unchanged; the clock picks up again from
+// the update that brings new keys.
+uint32_t scheduler_update(scheduler_t* scheduler, program_t* program, double now);
+
+// True if the last update found the program idle in FX0A. Nothing runs until scheduler_set_keys
+// changes the keys, so the host can block waiting for input.
+bool scheduler_suspended(const scheduler_t* scheduler);
+
+void scheduler_terminate(scheduler_t* scheduler);
@@ -0,0 +1,111 @@
+// Threads
+// pthreads everywhere but Windows.
+
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include "thread.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x2
+#endif
+
+static DWORD WINAPI thread_start(LPVOID arg)
+{
+	thread_t* thread = arg;
+	return (DWORD)thread->main(thread->arg);
+}
+
+bool thread_create(thread_t* thread, thread_main_t main, void* arg)
+{
+	thread->main = main;
+	thread->arg = arg;
+	thread->handle = CreateThread(NULL, 0, thread_start, thread, 0, NULL);
+	return thread->handle != NULL;
+}
+
+void thread_join(thread_t* thread)
+{
+	WaitForSingleObject(thread->handle, INFINITE);
+	CloseHandle(thread->handle);
+}
+
+static BOOL CALLBACK thread_once_start(PINIT_ONCE once, PVOID param, PVOID* context)
+{
+	((void (*)(void))param)();
+	return TRUE;
+}
+
+void thread_once(thread_once_t* once, void (*fn)(void))
+{
+	InitOnceExecuteOnce((PINIT_ONCE)once, thread_once_start, (PVOID)fn, NULL);
+}
+
+// Sleep() rounds up to the system timer tick, often 15.6 ms; a high resolution timer doesn't
+void thread_sleep(double seconds)
+{
+	HANDLE timer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+	if (timer == NULL)
+	{
+		Sleep((DWORD)(seconds * 1000.0));
+		return;
+	}
+
+	LARGE_INTEGER due;
+	due.QuadPart = -(LONGLONG)(seconds * 1e7);
+	SetWaitableTimer(timer, &due, 0, NULL, NULL, FALSE);
+	WaitForSingleObject(timer, INFINITE);
+	CloseHandle(timer);
+}
+
+void thread_yield()
+{
+	SwitchToThread();
+}
+
+#else
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+
+static void* thread_start(void* arg)
+{
+	thread_t* thread = arg;
+	thread->main(thread->arg);
+	return NULL;
+}
+
+bool thread_create(thread_t* thread, thread_main_t main, void* arg)
+{
+	thread->main = main;
+	thread->arg = arg;
+	return pthread_create(&thread->handle, NULL, thread_start, thread) == 0;
+}
+
+void thread_join(thread_t* thread)
+{
+	pthread_join(thread->handle, NULL);
+}
+
+void thread_once(thread_once_t* once, void (*fn)(void))
+{
+	pthread_once(once, fn);
+}
+
+void thread_sleep(double seconds)
+{
+	struct timespec duration = { .tv_sec = (time_t)seconds, .tv_nsec = (long)((seconds - (time_t)seconds) * 1e9) };
+	// Only a signal cuts the sleep short; any other failure would fail again
+	while (nanosleep(&duration, &duration) != 0 && errno == EINTR)
+		;
+}
+
+void thread_yield()
+{
+	sched_yield();
+}
+#endif
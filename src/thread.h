@@ -0,0 +1,46 @@
+#pragma once
+
+// Threads. A thin layer over pthreads and Win32, since C11 <threads.h> is missing from macOS and
+// older MSVC.
+
+#include <stdbool.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+typedef int (*thread_main_t)(void* arg);
+
+typedef struct thread_t
+{
+#ifdef _WIN32
+	void* handle;
+#else
+	pthread_t handle;
+#endif
+	thread_main_t main;	// Kept here until the thread starts; the thread_t must outlive the thread
+	void* arg;
+} thread_t;
+
+#ifdef _WIN32
+typedef struct thread_once_t { void* state; } thread_once_t; // Same layout as INIT_ONCE
+#define THREAD_ONCE_INIT { 0 }
+#else
+typedef pthread_once_t thread_once_t;
+#define THREAD_ONCE_INIT PTHREAD_ONCE_INIT
+#endif
+
+// Starts a thread running main(arg). Returns false if it can't be started.
+bool thread_create(thread_t* thread, thread_main_t main, void* arg);
+
+// Waits for the thread to finish.
+void thread_join(thread_t* thread);
+
+// Runs fn the first time it's called with a given once flag, from any thread; later calls wait
+// until it has finished.
+void thread_once(thread_once_t* once, void (*fn)(void));
+
+// Sleeps for at least the given number of seconds.
+void thread_sleep(double seconds);
+
+void thread_yield();
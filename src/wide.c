@@ -0,0 +1,465 @@
+// Wide engine
+// Structure-of-arrays lockstep execution of many machines. Each step groups the lanes by program
+// counter and opcode, then runs each group's instruction across the group's lane mask. While every
+// lane is at the same address in code no lane has written to, the whole step is one group and
+// needs a single fetch.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "wide.h"
+#include "program_internal.h"
+
+// Lanes are padded to a whole number of vectors so kernels never need a scalar tail
+#define WIDE_VECTOR 32
+
+// Lanes are always CHIP-8 machines
+#define WIDE_MEMORY_SIZE PROGRAM_MEMORY_SIZE
+
+typedef struct wide_t
+{
+	uint32_t lanes;		  // Machines
+	uint32_t stride;	  // Lanes rounded up to WIDE_VECTOR
+	uint8_t* vars[16];	  // vars[x][lane]
+	uint16_t* index;
+	uint16_t* pc;
+	uint8_t* delay_timer;
+	uint8_t* sound_timer;
+	uint8_t* active;	  // 0xFF for lanes in the group being executed
+	uint64_t* order;	  // Group key (PC and opcode) above lane number, sorted to find the groups
+	program_t** programs; // Memory and display of each lane
+
+	// Addresses any lane may have written, inclusive. Lanes start with identical memory, so
+	// outside this range one lane's code is every lane's.
+	uint32_t written_lo, written_hi;
+} wide_t;
+
+// Copies a lane's registers into its program, and back.
+static void wide_store_lane(wide_t* wide, uint32_t lane)
+{
+	program_t* program = wide->programs[lane];
+
+	for (int x = 0; x < 16; x++)
+		program->vars[x] = wide->vars[x][lane];
+	program->index = wide->index[lane];
+	program->pc = wide->pc[lane];
+	program->delay_timer = wide->delay_timer[lane];
+	program->sound_timer = wide->sound_timer[lane];
+}
+
+static void wide_load_lane(wide_t* wide, uint32_t lane)
+{
+	program_t* program = wide->programs[lane];
+
+	for (int x = 0; x < 16; x++)
+		wide->vars[x][lane] = program->vars[x];
+	wide->index[lane] = program->index;
+	wide->pc[lane] = program->pc;
+	wide->delay_timer[lane] = program->delay_timer;
+	wide->sound_timer[lane] = program->sound_timer;
+}
+
+// Creates the lanes, each with its program from make_program.
+static wide_t* wide_create(uint32_t lanes, program_t* (*make_program)(const void* source, size_t size), const void* source, size_t size)
+{
+	program_decode_init();
+
+	wide_t* wide = calloc(1, sizeof(wide_t));
+	if (wide == NULL || lanes == 0)
+	{
+		fprintf(stderr, "Wide: failed to allocate memory for object\n");
+		free(wide);
+		return NULL;
+	}
+
+	wide->lanes = lanes;
+	wide->stride = (lanes + WIDE_VECTOR - 1) / WIDE_VECTOR * WIDE_VECTOR;
+
+	bool ok = true;
+	for (int x = 0; x < 16; x++)
+		ok &= (wide->vars[x] = calloc(wide->stride, sizeof(uint8_t))) != NULL;
+	ok &= (wide->index = calloc(wide->stride, sizeof(uint16_t))) != NULL;
+	ok &= (wide->pc = calloc(wide->stride, sizeof(uint16_t))) != NULL;
+	ok &= (wide->delay_timer = calloc(wide->stride, sizeof(uint8_t))) != NULL;
+	ok &= (wide->sound_timer = calloc(wide->stride, sizeof(uint8_t))) != NULL;
+	ok &= (wide->active = calloc(wide->stride, sizeof(uint8_t))) != NULL;
+	ok &= (wide->order = calloc(lanes, sizeof(uint64_t))) != NULL;
+	ok &= (wide->programs = calloc(lanes, sizeof(program_t*))) != NULL;
+	wide->written_lo = WIDE_MEMORY_SIZE;
+	wide->written_hi = 0;
+
+	for (uint32_t i = 0; ok && i < lanes; i++)
+	{
+		wide->programs[i] = make_program(source, size);
+		ok &= wide->programs[i] != NULL;
+		if (ok)
+			wide_load_lane(wide, i);
+	}
+
+	if (!ok)
+	{
+		wide_destroy(wide);
+		return NULL;
+	}
+
+	return wide;
+}
+
+static program_t* wide_program_from_file(const void* path, size_t size)
+{
+	return program_init((char*)path);
+}
+
+static program_t* wide_program_from_rom(const void* rom, size_t size)
+{
+	program_t* program = program_init(NULL);
+	if (program && !program_load_rom(program, rom, size))
+	{
+		program_destroy(program);
+		return NULL;
+	}
+	return program;
+}
+
+wide_t* wide_init(const char* rom_path, uint32_t lanes)
+{
+	return wide_create(lanes, wide_program_from_file, rom_path, 0);
+}
+
+wide_t* wide_init_rom(const uint8_t* rom, size_t size, uint32_t lanes)
+{
+	return wide_create(lanes, wide_program_from_rom, rom, size);
+}
+
+void wide_destroy(wide_t* wide)
+{
+	if (wide == NULL)
+		return;
+
+	if (wide->programs)
+	{
+		for (uint32_t i = 0; i < wide->lanes; i++)
+			program_destroy(wide->programs[i]);
+	}
+
+	for (int x = 0; x < 16; x++)
+		free(wide->vars[x]);
+	free(wide->index);
+	free(wide->pc);
+	free(wide->delay_timer);
+	free(wide->sound_timer);
+	free(wide->active);
+	free(wide->order);
+	free(wide->programs);
+	free(wide);
+}
+
+uint32_t wide_lane_count(const wide_t* wide)
+{
+	return wide->lanes;
+}
+
+uint8_t* wide_vars(wide_t* wide, int x)
+{
+	return wide->vars[x & 0xF];
+}
+
+program_t* wide_lane(wide_t* wide, uint32_t lane)
+{
+	wide_store_lane(wide, lane);
+	return wide->programs[lane];
+}
+
+void wide_tick_timers(wide_t* wide)
+{
+	// Beeping lives in the lane's program, as nothing vectorized reads it
+	for (uint32_t i = 0; i < wide->lanes; i++)
+		wide->programs[i]->beeping = wide->sound_timer[i] > 0;
+
+	for (uint32_t i = 0; i < wide->stride; i++)
+	{
+		wide->delay_timer[i] -= wide->delay_timer[i] != 0;
+		wide->sound_timer[i] -= wide->sound_timer[i] != 0;
+	}
+}
+
+// Vector kernels. m is the active mask (0xFF or 0 per lane). Results are written before VF, and VF
+// is re-read after, so X or Y being F behaves exactly like the scalar handlers.
+#ifdef __AVX2__
+
+#define WIDE_LOAD(p) _mm256_loadu_si256((const __m256i*)(p))
+#define WIDE_STORE(p, v) _mm256_storeu_si256((__m256i*)(p), (v))
+#define WIDE_BLEND(old, new, m) _mm256_blendv_epi8((old), (new), (m))
+
+static void wide_kernel(wide_t* wide, const program_op_t* op)
+{
+	uint8_t* vx = wide->vars[op->x];
+	uint8_t* vy = wide->vars[op->y];
+	uint8_t* vf = wide->vars[0xF];
+	const __m256i one = _mm256_set1_epi8(1);
+
+	for (uint32_t i = 0; i < wide->stride; i += WIDE_VECTOR)
+	{
+		__m256i m = WIDE_LOAD(wide->active + i);
+		__m256i a = WIDE_LOAD(vx + i);
+		__m256i b = WIDE_LOAD(vy + i);
+		__m256i r, f;
+		bool flag = true;
+
+		switch (op->kind)
+		{
+		case k_op_ld_vx_nn:
+			r = _mm256_set1_epi8((char)op->nn);
+			flag = false;
+			break;
+		case k_op_add_vx_nn:
+			r = _mm256_add_epi8(a, _mm256_set1_epi8((char)op->nn));
+			flag = false;
+			break;
+		case k_op_ld_vx_vy:
+			r = b;
+			flag = false;
+			break;
+		case k_op_or:
+			r = _mm256_or_si256(a, b);
+			f = _mm256_setzero_si256();
+			break;
+		case k_op_and:
+			r = _mm256_and_si256(a, b);
+			f = _mm256_setzero_si256();
+			break;
+		case k_op_xor:
+			r = _mm256_xor_si256(a, b);
+			f = _mm256_setzero_si256();
+			break;
+		case k_op_add_vx_vy:
+			r = _mm256_add_epi8(a, b);
+			// Carry when the sum wrapped below an operand
+			f = _mm256_andnot_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(r, a), r), one);
+			break;
+		case k_op_sub:
+			r = _mm256_sub_epi8(a, b);
+			f = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(a, b), a), one);
+			break;
+		case k_op_subn:
+			r = _mm256_sub_epi8(b, a);
+			f = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(b, a), b), one);
+			break;
+		case k_op_shr:
+			r = _mm256_and_si256(_mm256_srli_epi16(b, 1), _mm256_set1_epi8(0x7F));
+			f = _mm256_and_si256(b, one);
+			break;
+		case k_op_shl:
+			r = _mm256_add_epi8(b, b);
+			f = _mm256_and_si256(_mm256_srli_epi16(b, 7), one);
+			break;
+		default:
+			return;
+		}
+
+		WIDE_STORE(vx + i, WIDE_BLEND(a, r, m));
+		if (flag)
+			WIDE_STORE(vf + i, WIDE_BLEND(WIDE_LOAD(vf + i), f, m));
+	}
+}
+
+#else
+
+// One loop per opcode rather than a switch per lane, so that each compiles to plain vector code.
+// result and flag are expressions of a (VX), b (VY) and r (the result). VX, VY and VF may be the
+// same array, but each iteration only touches its own lane, so there are no dependencies between
+// iterations for the compiler to guard against.
+#if defined(__clang__)
+#define WIDE_IVDEP _Pragma("clang loop vectorize(assume_safety)")
+#elif defined(__GNUC__)
+#define WIDE_IVDEP _Pragma("GCC ivdep")
+#elif defined(_MSC_VER)
+#define WIDE_IVDEP __pragma(loop(ivdep))
+#else
+#define WIDE_IVDEP
+#endif
+
+#define WIDE_LOOP(result, has_flag, flag) \
+	WIDE_IVDEP \
+	for (uint32_t i = 0; i < stride; i++) \
+	{ \
+		uint8_t m = active[i], a = vx[i], b = vy[i]; \
+		uint8_t r = (uint8_t)(result); \
+		(void)b; \
+		vx[i] = (a & ~m) | (r & m); \
+		if (has_flag) \
+			vf[i] = (vf[i] & ~m) | ((uint8_t)(flag) & m); \
+	}
+
+static void wide_kernel(wide_t* wide, const program_op_t* op)
+{
+	uint8_t* vx = wide->vars[op->x];
+	uint8_t* vy = wide->vars[op->y];
+	uint8_t* vf = wide->vars[0xF];
+	uint8_t nn = op->nn;
+
+	// Locals, since byte stores could otherwise alias them and force a reload every iteration
+	const uint8_t* active = wide->active;
+	uint32_t stride = wide->stride;
+
+	switch (op->kind)
+	{
+	case k_op_ld_vx_nn: WIDE_LOOP(nn, false, 0); break;
+	case k_op_add_vx_nn: WIDE_LOOP(a + nn, false, 0); break;
+	case k_op_ld_vx_vy: WIDE_LOOP(b, false, 0); break;
+	case k_op_or: WIDE_LOOP(a | b, true, 0); break;
+	case k_op_and: WIDE_LOOP(a & b, true, 0); break;
+	case k_op_xor: WIDE_LOOP(a ^ b, true, 0); break;
+	case k_op_add_vx_vy: WIDE_LOOP(a + b, true, r < a); break;
+	case k_op_sub: WIDE_LOOP(a - b, true, a >= b); break;
+	case k_op_subn: WIDE_LOOP(b - a, true, b >= a); break;
+	case k_op_shr: WIDE_LOOP(b >> 1, true, b & 1); break;
+	case k_op_shl: WIDE_LOOP(b << 1, true, b >> 7); break;
+	default: break;
+	}
+}
+
+#endif
+
+// Widens the written range by the at most 16 bytes a store at I touches.
+static void wide_note_write(wide_t* wide, uint16_t index)
+{
+	uint32_t lo = index % WIDE_MEMORY_SIZE;
+	uint32_t hi = lo + 15;
+
+	// A store wrapping past the end of memory could land anywhere as far as this range goes
+	if (hi >= WIDE_MEMORY_SIZE)
+	{
+		lo = 0;
+		hi = WIDE_MEMORY_SIZE - 1;
+	}
+
+	wide->written_lo = lo < wide->written_lo ? lo : wide->written_lo;
+	wide->written_hi = hi > wide->written_hi ? hi : wide->written_hi;
+}
+
+// Runs one instruction on every lane of the active group. All of them are at the same address
+// with the same opcode there.
+static void wide_exec_group(wide_t* wide, const program_op_t* op)
+{
+	for (uint32_t i = 0; i < wide->stride; i++)
+		wide->pc[i] += wide->active[i] & 2;
+
+	switch (op->kind)
+	{
+	case k_op_sys:
+		break;
+	case k_op_jp:
+		for (uint32_t i = 0; i < wide->stride; i++)
+			wide->pc[i] = wide->active[i] ? op->nnn : wide->pc[i];
+		break;
+	case k_op_ld_i:
+		for (uint32_t i = 0; i < wide->stride; i++)
+			wide->index[i] = wide->active[i] ? op->nnn : wide->index[i];
+		break;
+	case k_op_ld_vx_nn:
+	case k_op_add_vx_nn:
+	case k_op_ld_vx_vy:
+	case k_op_or:
+	case k_op_and:
+	case k_op_xor:
+	case k_op_add_vx_vy:
+	case k_op_sub:
+	case k_op_subn:
+	case k_op_shr:
+	case k_op_shl:
+		wide_kernel(wide, op);
+		break;
+	default:
+		// No vector path: run the scalar handler on each lane's own program
+		for (uint32_t i = 0; i < wide->lanes; i++)
+		{
+			if (!wide->active[i])
+				continue;
+
+			// FX33 and FX55 are the only writes to memory; note where they may land
+			if (op->kind == k_op_ld_b_vx || op->kind == k_op_ld_i_vx)
+				wide_note_write(wide, wide->index[i]);
+
+			wide_store_lane(wide, i);
+			wide->programs[i]->handlers[op->kind](wide->programs[i], op);
+			wide->programs[i]->events = 0;
+			wide_load_lane(wide, i);
+		}
+		break;
+	}
+}
+
+static uint16_t wide_fetch(wide_t* wide, uint32_t lane, uint16_t pc)
+{
+	const uint8_t* memory = wide->programs[lane]->memory;
+	return (memory[pc] << 8) | memory[(pc + 1) % WIDE_MEMORY_SIZE];
+}
+
+static int wide_compare_keys(const void* a, const void* b)
+{
+	uint64_t ka = *(const uint64_t*)a, kb = *(const uint64_t*)b;
+	return (ka > kb) - (ka < kb);
+}
+
+// Runs a step with lanes at different addresses, or in code a lane may have rewritten. Sorting the
+// lanes by address and opcode puts each group in one run, so the grouping is O(lanes log lanes)
+// however many groups there are.
+static void wide_step_groups(wide_t* wide)
+{
+	for (uint32_t i = 0; i < wide->lanes; i++)
+	{
+		uint32_t key = ((uint32_t)wide->pc[i] << 16) | wide_fetch(wide, i, wide->pc[i]);
+		wide->order[i] = ((uint64_t)key << 32) | i;
+	}
+
+	qsort(wide->order, wide->lanes, sizeof(uint64_t), wide_compare_keys);
+
+	uint32_t first = 0;
+	while (first < wide->lanes)
+	{
+		uint32_t key = wide->order[first] >> 32;
+		uint32_t end = first;
+		while (end < wide->lanes && (uint32_t)(wide->order[end] >> 32) == key)
+			wide->active[(uint32_t)wide->order[end++]] = 0xFF;
+
+		wide_exec_group(wide, &program_decode_table[key & 0xFFFF]);
+
+		for (uint32_t i = first; i < end; i++)
+			wide->active[(uint32_t)wide->order[i]] = 0;
+		first = end;
+	}
+}
+
+uint64_t wide_run(wide_t* wide, uint64_t steps)
+{
+	for (uint64_t step = 0; step < steps; step++)
+	{
+		uint16_t pc = wide->pc[0] % WIDE_MEMORY_SIZE;
+		uint16_t diverged = 0;
+		for (uint32_t i = 0; i < wide->lanes; i++)
+		{
+			wide->pc[i] %= WIDE_MEMORY_SIZE;
+			diverged |= wide->pc[i] ^ pc;
+		}
+
+		// The common case: one address, and code nobody has written, so lane 0's opcode is everyone's
+		bool written = pc + 1u >= wide->written_lo && pc <= wide->written_hi;
+		if (diverged || written)
+		{
+			wide_step_groups(wide);
+			continue;
+		}
+
+		memset(wide->active, 0xFF, wide->lanes);
+		wide_exec_group(wide, &program_decode_table[wide_fetch(wide, 0, pc)]);
+		memset(wide->active, 0, wide->lanes);
+	}
+
+	return steps;
+}
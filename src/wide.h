@@ -0,0 +1,40 @@
+#pragma once
+
+// Lockstep engine. Runs many copies of one ROM side by side, with registers kept as structure of
+// arrays so that ALU opcodes execute across every lane at once. Lanes whose program counters
+// diverge are stepped in groups; opcodes without a vector path run through the scalar handlers.
+//
+// CHIP-8 only: every lane runs k_program_platform_chip8, and the vector kernels implement its
+// COSMAC VIP quirks. There is no way to pick another platform.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "program.h"
+
+typedef struct wide_t wide_t;
+
+// Creates the given number of lanes, each with the ROM loaded. Returns NULL if the ROM can't be
+// loaded.
+wide_t* wide_init(const char* rom_path, uint32_t lanes);
+
+// Like wide_init, with the ROM image given in memory.
+wide_t* wide_init_rom(const uint8_t* rom, size_t size, uint32_t lanes);
+
+void wide_destroy(wide_t* wide);
+
+uint32_t wide_lane_count(const wide_t* wide);
+
+// Register VX of every lane, indexed by lane. Writable, e.g. to seed lanes differently.
+uint8_t* wide_vars(wide_t* wide, int x);
+
+// Runs the given number of steps. Every lane executes exactly one instruction per step, so a lane
+// ends in the same state as a scalar program run for the same number of cycles.
+uint64_t wide_run(wide_t* wide, uint64_t steps);
+
+// Decrements every lane's delay and sound timers. Call at 60 Hz of emulated time.
+void wide_tick_timers(wide_t* wide);
+
+// Returns the program backing a lane (its memory and display), with the lane's registers copied
+// in so the program_* functions see its current state.
+program_t* wide_lane(wide_t* wide, uint32_t lane);
@@ -1,6 +1,9 @@
 // Window manager. Controls window instances and user input.
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
 
 #include "wm.h"
 
@@ -27,26 +30,101 @@ static const char* vertex_shader_text =
 "	 TexCoord = texcoord;\n"
 "}\n";
 
+// Unpacks the 1-bpp display planes on the GPU. Each texel holds 32 pixels; a row is two 64-bit
+// words stored little-endian, so the high half of a word (its left 32 pixels) is the second texel
+// of it. The second plane sits below the first, and a pixel's bits in both pick its colour. Only the
+// top-left corner given by resolution is shown.
 static const char* fragment_shader_text =
 "#version 150 core\n"
-"uniform sampler2D tex;\n"
+"uniform usampler2D tex;\n"
+"uniform usampler2D prev_tex;\n"
+"uniform vec3 palette[4];\n"
+"uniform float scanline;\n"
+"uniform float ghost;\n"
+"uniform ivec2 resolution;\n"
 "varying vec2 TexCoord;\n"
 "varying vec3 color;\n"
+"int bit(usampler2D t, ivec2 p)\n"
+"{\n"
+"    uint word = texelFetch(t, ivec2((p.x >> 6) * 2 + ((p.x & 63) < 32 ? 1 : 0), p.y), 0).r;\n"
+"    return int((word >> uint(31 - (p.x & 31))) & 1u);\n"
+"}\n"
+"int pixel(usampler2D t, ivec2 p)\n"
+"{\n"
+"    return bit(t, p) | (bit(t, p + ivec2(0, 64)) << 1);\n"
+"}\n"
+"void main()\n"
+"{\n"
+"    ivec2 p = ivec2(clamp(TexCoord, 0.0, 0.9999) * vec2(resolution));\n"
+"    int index = pixel(tex, p);\n"
+"    vec3 col = index != 0 ? palette[index] : mix(palette[0], palette[pixel(prev_tex, p)], ghost);\n"
+"    float line = fract(TexCoord.y * float(resolution.y)) > 0.5 ? 1.0 - scanline : 1.0;\n"
+"    gl_FragColor = vec4(col * line, 1.0);\n"
+"}\n";
+
+// Text overlay: a strip of 3 x 5 glyphs in the top-left corner, white on black
+static const char* overlay_vertex_shader_text =
+"#version 150 core\n"
+"attribute vec2 vPos;\n"
+"attribute vec2 texcoord;\n"
+"varying vec2 TexCoord;\n"
+"void main()\n"
+"{\n"
+"    gl_Position = vec4(vPos, 0.0, 1.0);\n"
+"    TexCoord = texcoord;\n"
+"}\n";
+
+static const char* overlay_fragment_shader_text =
+"#version 150 core\n"
+"uniform sampler2D tex;\n"
+"varying vec2 TexCoord;\n"
 "void main()\n"
 "{\n"
-"    gl_FragColor = texture(tex, TexCoord);\n"
+"    gl_FragColor = vec4(vec3(texture2D(tex, TexCoord).r), 1.0);\n"
 "}\n";
 
+#define WM_OVERLAY_MAX 64		// Characters
+#define WM_OVERLAY_GLYPH_WIDTH 4	// 3 pixels and a space
+#define WM_OVERLAY_HEIGHT 7		// 5 pixels and a border above and below
+#define WM_OVERLAY_WIDTH (WM_OVERLAY_MAX * WM_OVERLAY_GLYPH_WIDTH + 1)
+#define WM_OVERLAY_SCALE 2		// Screen pixels per overlay pixel
+
+// 3 x 5 glyphs, a row per byte, leftmost pixel in bit 2. Lowercase is drawn as uppercase, and
+// anything missing as a space.
+static const uint8_t k_overlay_font[128][5] =
+{
+	['0'] = { 7, 5, 5, 5, 7 }, ['1'] = { 2, 6, 2, 2, 7 }, ['2'] = { 7, 1, 7, 4, 7 }, ['3'] = { 7, 1, 7, 1, 7 },
+	['4'] = { 5, 5, 7, 1, 1 }, ['5'] = { 7, 4, 7, 1, 7 }, ['6'] = { 7, 4, 7, 5, 7 }, ['7'] = { 7, 1, 2, 2, 2 },
+	['8'] = { 7, 5, 7, 5, 7 }, ['9'] = { 7, 5, 7, 1, 7 }, ['.'] = { 0, 0, 0, 0, 2 }, ['/'] = { 1, 1, 2, 4, 4 },
+	[':'] = { 0, 2, 0, 2, 0 }, ['-'] = { 0, 0, 7, 0, 0 }, [','] = { 0, 0, 0, 2, 4 },
+	['A'] = { 2, 5, 7, 5, 5 }, ['B'] = { 6, 5, 6, 5, 6 }, ['C'] = { 3, 4, 4, 4, 3 }, ['D'] = { 6, 5, 5, 5, 6 },
+	['E'] = { 7, 4, 6, 4, 7 }, ['F'] = { 7, 4, 6, 4, 4 }, ['G'] = { 3, 4, 5, 5, 3 }, ['H'] = { 5, 5, 7, 5, 5 },
+	['I'] = { 7, 2, 2, 2, 7 }, ['J'] = { 1, 1, 1, 5, 2 }, ['K'] = { 5, 5, 6, 5, 5 }, ['L'] = { 4, 4, 4, 4, 7 },
+	['M'] = { 5, 7, 7, 5, 5 }, ['N'] = { 6, 5, 5, 5, 5 }, ['O'] = { 2, 5, 5, 5, 2 }, ['P'] = { 6, 5, 6, 4, 4 },
+	['Q'] = { 2, 5, 5, 6, 3 }, ['R'] = { 6, 5, 6, 5, 5 }, ['S'] = { 3, 4, 2, 1, 6 }, ['T'] = { 7, 2, 2, 2, 2 },
+	['U'] = { 5, 5, 5, 5, 7 }, ['V'] = { 5, 5, 5, 5, 2 }, ['W'] = { 5, 5, 7, 7, 5 }, ['X'] = { 5, 5, 2, 5, 5 },
+	['Y'] = { 5, 5, 2, 2, 2 }, ['Z'] = { 7, 1, 2, 4, 7 },
+};
+
 // Main window manager object
 typedef struct wm_t
 {
 	GLFWwindow* window;
 	uint32_t key_mask;
+	uint16_t keypad;		// CHIP-8 keys held, bit n for key n
 
 	GLuint vertex_buffer, vertex_shader, fragment_shader, program;
+	GLuint display_texture; // Packed display, allocated once; rows are updated in place as they change
+	GLuint prev_texture;	// Display as of the previous frame, for ghosting
+	bool prev_stale;		// The last frame changed the display, so prev_texture lags a frame behind
 
 	// Shader parameters
-	GLint mvp_location, vpos_location, vcol_location, texture;
+	GLint mvp_location, vpos_location, vcol_location, texture, resolution_location;
+	uint32_t width, height;	// Display size last shown
+
+	GLuint overlay_program, overlay_buffer, overlay_texture;
+	GLint overlay_vpos_location, overlay_texcoord_location;
+	uint32_t overlay_width;	// Overlay pixels in use; 0 hides it
 } wm_t;
 
 static const struct
@@ -70,10 +148,49 @@ const struct
 k_key_map[]=
 {
 	{.virtual_key = GLFW_KEY_ESCAPE, .vc_key = k_key_esc,},
+	{.virtual_key = GLFW_KEY_BACKSPACE, .vc_key = k_key_rewind,},
+};
+
+// CHIP-8 keypad layout on a QWERTY keyboard
+const struct
+{
+	int virtual_key;
+	int chip8_key;
+}
+k_keypad_map[]=
+{
+	{GLFW_KEY_1, 0x1}, {GLFW_KEY_2, 0x2}, {GLFW_KEY_3, 0x3}, {GLFW_KEY_4, 0xC},
+	{GLFW_KEY_Q, 0x4}, {GLFW_KEY_W, 0x5}, {GLFW_KEY_E, 0x6}, {GLFW_KEY_R, 0xD},
+	{GLFW_KEY_A, 0x7}, {GLFW_KEY_S, 0x8}, {GLFW_KEY_D, 0x9}, {GLFW_KEY_F, 0xE},
+	{GLFW_KEY_Z, 0xA}, {GLFW_KEY_X, 0x0}, {GLFW_KEY_C, 0xB}, {GLFW_KEY_V, 0xF},
 };
 
 static void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
+	wm_t* wm = glfwGetWindowUserPointer(window);
+
+	for (size_t i = 0; i < sizeof(k_key_map) / sizeof(k_key_map[0]); i++)
+	{
+		if (k_key_map[i].virtual_key != key)
+			continue;
+
+		if (action == GLFW_PRESS)
+			wm->key_mask |= k_key_map[i].vc_key;
+		else if (action == GLFW_RELEASE)
+			wm->key_mask &= ~k_key_map[i].vc_key;
+	}
+
+	for (size_t i = 0; i < sizeof(k_keypad_map) / sizeof(k_keypad_map[0]); i++)
+	{
+		if (k_keypad_map[i].virtual_key != key)
+			continue;
+
+		if (action == GLFW_PRESS)
+			wm->keypad |= 1 << k_keypad_map[i].chip8_key;
+		else if (action == GLFW_RELEASE)
+			wm->keypad &= ~(1 << k_keypad_map[i].chip8_key);
+	}
+
 	switch (key)
 	{
 		case GLFW_KEY_ESCAPE:
@@ -133,6 +250,64 @@ static void glfw_error_callback(int error, const char* description)
 	fprintf(stderr, "GLFW error: %s\n", description);
 }
 
+// Compiles and links a vertex and fragment shader pair. Returns 0 on failure.
+static GLuint compile_program(const char* vertex_text, const char* fragment_text)
+{
+	GLuint shaders[2] = { glCreateShader(GL_VERTEX_SHADER), glCreateShader(GL_FRAGMENT_SHADER) };
+	const char* texts[2] = { vertex_text, fragment_text };
+	GLuint program = glCreateProgram();
+
+	for (int i = 0; i < 2; i++)
+	{
+		glShaderSource(shaders[i], 1, &texts[i], NULL);
+		glCompileShader(shaders[i]);
+
+		GLint success;
+		glGetShaderiv(shaders[i], GL_COMPILE_STATUS, &success);
+		if (success == GL_FALSE)
+		{
+			char log[1024];
+			glGetShaderInfoLog(shaders[i], sizeof(log), NULL, log);
+			fprintf(stderr, "WM: shader failed to compile: %s\n", log);
+			glDeleteShader(shaders[0]);
+			glDeleteShader(shaders[1]);
+			glDeleteProgram(program);
+			return 0;
+		}
+
+		glAttachShader(program, shaders[i]);
+	}
+
+	glLinkProgram(program);
+	glDeleteShader(shaders[0]);
+	glDeleteShader(shaders[1]);
+	return program;
+}
+
+// Sets up the text overlay, hidden until wm_set_overlay gives it text. Its texture goes on unit 2,
+// after the display's two.
+static void init_overlay(wm_t* wm)
+{
+	wm->overlay_width = 0;
+	wm->overlay_program = compile_program(overlay_vertex_shader_text, overlay_fragment_shader_text);
+	if (wm->overlay_program == 0)
+		return;
+
+	wm->overlay_vpos_location = glGetAttribLocation(wm->overlay_program, "vPos");
+	wm->overlay_texcoord_location = glGetAttribLocation(wm->overlay_program, "texcoord");
+	glUseProgram(wm->overlay_program);
+	glUniform1i(glGetUniformLocation(wm->overlay_program, "tex"), 2);
+
+	glGenBuffers(1, &wm->overlay_buffer);
+	glGenTextures(1, &wm->overlay_texture);
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, wm->overlay_texture);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_R8, WM_OVERLAY_WIDTH, WM_OVERLAY_HEIGHT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glActiveTexture(GL_TEXTURE0);
+}
+
 // Handles the initialization of GL-related buffers.
 void init_gl(wm_t* wm)
 {
@@ -202,13 +377,41 @@ void init_gl(wm_t* wm)
 	wm->vpos_location = glGetAttribLocation(wm->program, "vPos");
 	wm->vcol_location = glGetAttribLocation(wm->program, "vCol");
 	wm->texture = glGetAttribLocation(wm->program, "texcoord");
+	wm->resolution_location = glGetUniformLocation(wm->program, "resolution");
+	wm->width = 64;
+	wm->height = 32;
+	glUniform2i(wm->resolution_location, wm->width, wm->height);
 
 	glEnableVertexAttribArray(wm->vpos_location);
-	glVertexAttribPointer(wm->vpos_location, 2, GL_FLOAT, GL_FALSE, sizeof(vertices[0]), (void*) 0);
 	glEnableVertexAttribArray(wm->vcol_location);
-	glVertexAttribPointer(wm->vcol_location, 3, GL_FLOAT, GL_FALSE, sizeof(vertices[0]), (void*) (sizeof(float) * 2));
 	glEnableVertexAttribArray(wm->texture);
-	glVertexAttribPointer(wm->texture, 2, GL_FLOAT, GL_FALSE, sizeof(vertices[0]), (void*) (sizeof(float) * 5));
+
+	// Display textures: the packed rows of both planes as-is, immutable storage so they're never
+	// reallocated. Integer textures can't be filtered, the shader fetches texels directly. They start
+	// cleared, since single plane displays never upload the second.
+	static const uint32_t blank[WM_DISPLAY_PLANES * WM_DISPLAY_HEIGHT][WM_DISPLAY_WORDS * 2];
+	GLuint textures[2];
+	glGenTextures(2, textures);
+	wm->display_texture = textures[0];
+	wm->prev_texture = textures[1];
+
+	for (int i = 0; i < 2; i++)
+	{
+		glActiveTexture(GL_TEXTURE0 + i);
+		glBindTexture(GL_TEXTURE_2D, textures[i]);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_R32UI, WM_DISPLAY_WORDS * 2, WM_DISPLAY_PLANES * WM_DISPLAY_HEIGHT);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, WM_DISPLAY_WORDS * 2, WM_DISPLAY_PLANES * WM_DISPLAY_HEIGHT, GL_RED_INTEGER, GL_UNSIGNED_INT, blank);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	}
+
+	glUniform1i(glGetUniformLocation(wm->program, "prev_tex"), 1);
+	wm->prev_stale = false;
+	wm_set_palette(wm, (const float[12])WM_DEFAULT_PALETTE);
+	wm_set_effects(wm, 0.0f, 0.0f);
+	glUniform1i(glGetUniformLocation(wm->program, "tex"), 0);
+
+	init_overlay(wm);
 }
 
 // Initializes window, GL, UI, input callbacks, etc.
@@ -222,6 +425,7 @@ wm_t* wm_init()
 	}
 	// Initialize key mask
 	wm->key_mask = 0;
+	wm->keypad = 0;
 
 	// Initialize GLFW
 	if(!glfwInit())
@@ -230,7 +434,7 @@ wm_t* wm_init()
 		return NULL;
 	}
 
-	wm->window = glfwCreateWindow(640, 480, "VC-CHIP-8", NULL, NULL);
+	wm->window = glfwCreateWindow(640, 480, WM_TITLE, NULL, NULL);
 	if(!wm->window)
 	{
 		glfwTerminate();
@@ -249,6 +453,7 @@ wm_t* wm_init()
 
 	// Set GLFW values
 	glfwSwapInterval(1);
+	glfwSetWindowUserPointer(wm->window, wm);
 	glfwSetKeyCallback(wm->window, key_callback);
 
 	int width, height;
@@ -262,13 +467,29 @@ wm_t* wm_init()
 	return wm;
 }
 
+uint32_t wm_key_mask(const wm_t* wm)
+{
+	return wm->key_mask;
+}
+
+uint16_t wm_keypad(const wm_t* wm)
+{
+	return wm->keypad;
+}
+
 int wm_should_close(wm_t* wm)
 {
 	return glfwWindowShouldClose(wm->window);
 }
 
-// Update the given window.
-void wm_update(wm_t* wm)
+// Blocks without using any CPU until GLFW has an event, e.g. while the program waits for a key.
+void wm_wait_events(wm_t* wm)
+{
+	glfwWaitEvents();
+}
+
+// Draws the display quad into the back buffer.
+static void wm_render(wm_t* wm)
 {
 	float ratio;
 	int width, height;
@@ -288,47 +509,179 @@ void wm_update(wm_t* wm)
 	glm_ortho(-ratio, ratio, -1.0f, 1.0f, 1.0f, -1.0f, p);
 	glm_mat4_mul(m, p, mvp);
 
+	// The overlay points the attributes at its own buffer, so they're set on every draw
 	glUseProgram(wm->program);
+	glBindBuffer(GL_ARRAY_BUFFER, wm->vertex_buffer);
+	glVertexAttribPointer(wm->vpos_location, 2, GL_FLOAT, GL_FALSE, sizeof(vertices[0]), (void*) 0);
+	glVertexAttribPointer(wm->vcol_location, 3, GL_FLOAT, GL_FALSE, sizeof(vertices[0]), (void*) (sizeof(float) * 2));
+	glVertexAttribPointer(wm->texture, 2, GL_FLOAT, GL_FALSE, sizeof(vertices[0]), (void*) (sizeof(float) * 5));
 	glUniformMatrix4fv(wm->mvp_location, 1, GL_FALSE, (const GLfloat*) mvp);
 	//glDrawElements
 	glDrawArrays(GL_TRIANGLES, 0, 3);
 	glDrawArrays(GL_TRIANGLES, 1, 3);
 
+	if (wm->overlay_width == 0)
+		return;
+
+	// Overlay quad in the top-left corner, at a whole number of screen pixels per overlay pixel
+	float right = -1.0f + 2.0f * WM_OVERLAY_SCALE * wm->overlay_width / width;
+	float bottom = 1.0f - 2.0f * WM_OVERLAY_SCALE * WM_OVERLAY_HEIGHT / height;
+	float s = (float)wm->overlay_width / WM_OVERLAY_WIDTH;
+	const float quad[4][4] =
+	{
+		{ -1.0f, bottom, 0.0f, 1.0f },
+		{ -1.0f, 1.0f, 0.0f, 0.0f },
+		{ right, bottom, s, 1.0f },
+		{ right, 1.0f, s, 0.0f },
+	};
+
+	glUseProgram(wm->overlay_program);
+	glBindBuffer(GL_ARRAY_BUFFER, wm->overlay_buffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STREAM_DRAW);
+	glEnableVertexAttribArray(wm->overlay_vpos_location);
+	glVertexAttribPointer(wm->overlay_vpos_location, 2, GL_FLOAT, GL_FALSE, sizeof(quad[0]), (void*) 0);
+	glEnableVertexAttribArray(wm->overlay_texcoord_location);
+	glVertexAttribPointer(wm->overlay_texcoord_location, 2, GL_FLOAT, GL_FALSE, sizeof(quad[0]), (void*) (sizeof(float) * 2));
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
+
+// Update the given window.
+void wm_update(wm_t* wm)
+{
+	wm_render(wm);
 	glfwSwapBuffers(wm->window);
 	glfwPollEvents();
 }
 
-// Takes a set of floats representing RGB values and creates a GL texture from them.
-// TODO: specification
-// TODO: Another function which *updates* an existing texture instead of reinitializing a new one at the same position
-void wm_init_texture(wm_t* wm, float* tex_data, int h, int w)
+void wm_poll_events(wm_t* wm)
+{
+	glfwPollEvents();
+}
+
+// glFinish makes the GPU's share of the frame count towards the time measured around each call.
+void wm_draw(wm_t* wm)
+{
+	wm_render(wm);
+	glFinish();
+}
+
+// With vsync on, the finish after the swap blocks until the buffers have flipped at the vblank.
+void wm_swap(wm_t* wm)
+{
+	glfwSwapBuffers(wm->window);
+	glFinish();
+}
+
+double wm_refresh_rate(const wm_t* wm)
 {
-	// Test: b/w checkerboard
-	float pixels[] =
+	GLFWmonitor* monitor = glfwGetWindowMonitor(wm->window);
+	if (monitor == NULL)
+		monitor = glfwGetPrimaryMonitor();
+
+	const GLFWvidmode* mode = monitor ? glfwGetVideoMode(monitor) : NULL;
+	return mode && mode->refreshRate > 0 ? mode->refreshRate : WM_DEFAULT_REFRESH_RATE;
+}
+
+// Rasterizes the text into the overlay texture, one row of glyphs with a border all round.
+void wm_set_overlay(wm_t* wm, const char* text)
+{
+	if (wm->overlay_program == 0)
+		return;
+
+	static uint8_t pixels[WM_OVERLAY_HEIGHT][WM_OVERLAY_WIDTH];
+	memset(pixels, 0, sizeof(pixels));
+
+	size_t length = text ? strlen(text) : 0;
+	if (length > WM_OVERLAY_MAX)
+		length = WM_OVERLAY_MAX;
+
+	for (size_t i = 0; i < length; i++)
 	{
-		0.0f, 0.0f, 0.0f,	1.0f, 1.0f, 1.0f,
-		1.0f, 1.0f, 1.0f,   0.0f, 0.0f, 0.0f,
-	};
+		unsigned char c = (unsigned char)toupper((unsigned char)text[i]);
+		if (c >= 128)
+			continue;
+
+		for (int y = 0; y < 5; y++)
+			for (int x = 0; x < 3; x++)
+				if (k_overlay_font[c][y] & (4 >> x))
+					pixels[1 + y][1 + i * WM_OVERLAY_GLYPH_WIDTH + x] = 0xFF;
+	}
+
+	wm->overlay_width = length ? (uint32_t)(length * WM_OVERLAY_GLYPH_WIDTH + 1) : 0;
 
-	GLuint texture;
-	glGenTextures(1, &texture); // invalid value occurring here - possibly shader compilation issue
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, wm->overlay_texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, WM_OVERLAY_WIDTH, WM_OVERLAY_HEIGHT, GL_RED, GL_UNSIGNED_BYTE, pixels);
 	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, texture);
+}
 
-	// Why does the specification specify that "border" has to be 0?
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w, h, 0, GL_RGB, GL_FLOAT, tex_data);	
-	glUniform1i(glGetUniformLocation(wm->program, "tex"), 0);
+// Uploads the rows of the packed display that changed. Only rows with their bit set in dirty_rows
+// are read; runs of adjacent rows go up in a single call. The previous frame is kept in a second
+// texture on the GPU for ghosting, copied there only when a frame changes the display or the one
+// after catches it up, so an unchanging display costs no GPU work.
+void wm_update_texture(wm_t* wm, const uint64_t* rows, uint64_t dirty_rows, uint32_t planes, uint32_t width, uint32_t height)
+{
+	if (width != wm->width || height != wm->height)
+	{
+		wm->width = width;
+		wm->height = height;
+		glUseProgram(wm->program);
+		glUniform2i(wm->resolution_location, width, height);
+	}
 
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	if (dirty_rows != 0 || wm->prev_stale)
+	{
+		glCopyImageSubData(wm->display_texture, GL_TEXTURE_2D, 0, 0, 0, 0,
+			wm->prev_texture, GL_TEXTURE_2D, 0, 0, 0, 0,
+			WM_DISPLAY_WORDS * 2, WM_DISPLAY_PLANES * WM_DISPLAY_HEIGHT, 1);
+	}
+
+	wm->prev_stale = dirty_rows != 0;
+	if (dirty_rows == 0)
+		return;
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, wm->display_texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+	// A dirty row is uploaded in every plane in use
+	for (uint32_t plane = 0; plane < planes && plane < WM_DISPLAY_PLANES; plane++)
+	{
+		const uint64_t* plane_rows = rows + plane * WM_DISPLAY_HEIGHT * WM_DISPLAY_WORDS;
+		int row = 0;
+		while (row < WM_DISPLAY_HEIGHT)
+		{
+			if (!(dirty_rows & (1ULL << row)))
+			{
+				row++;
+				continue;
+			}
+
+			int first = row;
+			while (row < WM_DISPLAY_HEIGHT && (dirty_rows & (1ULL << row)))
+				row++;
+
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, plane * WM_DISPLAY_HEIGHT + first, WM_DISPLAY_WORDS * 2, row - first, GL_RED_INTEGER, GL_UNSIGNED_INT, plane_rows + first * WM_DISPLAY_WORDS);
+		}
+	}
+}
 
-	//*id = texture;
-	glGenerateMipmap(GL_TEXTURE_2D);
+// Sets the colours of the four pixel values (four RGB triples).
+void wm_set_palette(wm_t* wm, const float* palette)
+{
+	glUseProgram(wm->program);
+	glUniform3fv(glGetUniformLocation(wm->program, "palette"), 4, palette);
 }
 
-// TODO: function which replaces the texture at an existing ID
+// Sets the post effects: how much to darken alternate scanlines, and how much of the previous
+// frame to keep visible (0 to 1 each).
+void wm_set_effects(wm_t* wm, float scanline, float ghost)
+{
+	glUseProgram(wm->program);
+	glUniform1f(glGetUniformLocation(wm->program, "scanline"), scanline);
+	glUniform1f(glGetUniformLocation(wm->program, "ghost"), ghost);
+}
 
 // Uninitialize window and free related resources.
 void wm_terminate(wm_t* wm)
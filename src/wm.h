@@ -2,21 +2,72 @@
 
 // Window manager
 
+#include <stdint.h>
+
+// Largest display (SUPER-CHIP high resolution): packed 64-bit words per row, and rows, in up to
+// two bitplanes (XO-CHIP)
+#define WM_DISPLAY_WORDS 2
+#define WM_DISPLAY_HEIGHT 64
+#define WM_DISPLAY_PLANES 2
+
+#define WM_TITLE "VC-CHIP-8"
+#define WM_DEFAULT_REFRESH_RATE 60.0 // Used when the monitor doesn't report one
+
+// Black, white, and two greys for the XO-CHIP plane colours
+#define WM_DEFAULT_PALETTE { 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f, 0.6f, 0.6f, 0.6f, 0.3f, 0.3f, 0.3f }
+
 typedef struct wm_t wm_t;
 
 // Keyboard keymask
 enum
 {
 	k_key_esc = 1 << 0,
+	k_key_rewind = 1 << 1,
 };
 
 // Initialization function. Returns reference to window manager object.
 wm_t* wm_init();
 
+// Draws the display, swaps and polls input, in that order.
 void wm_update(wm_t* wm);
 
+// The parts of wm_update, for hosts that pace frames themselves: poll input first, then draw
+// (returns once the GPU has finished) and swap (returns once the frame is on screen).
+void wm_poll_events(wm_t* wm);
+void wm_draw(wm_t* wm);
+void wm_swap(wm_t* wm);
+
+// Refresh rate in Hz of the monitor showing the window.
+double wm_refresh_rate(const wm_t* wm);
+
+// Shows a line of text over the top-left corner of the window, or hides it when NULL or empty. Only
+// digits, letters and a little punctuation are drawn.
+void wm_set_overlay(wm_t* wm, const char* text);
+
 void wm_terminate(wm_t* wm);
 
-void wm_init_texture(wm_t* wm, float* tex_data, int h, int w);
+// Uploads the changed rows of the packed display (WM_DISPLAY_WORDS words per row, one bit per
+// pixel, leftmost pixel in the high bit, WM_DISPLAY_HEIGHT rows per plane) and shows its top-left
+// width x height pixels. Only the first planes planes are read. Pixels are expanded by the
+// fragment shader. Call once per new emulated frame, not per redraw: the frame before is kept for
+// ghosting.
+void wm_update_texture(wm_t* wm, const uint64_t* rows, uint64_t dirty_rows, uint32_t planes, uint32_t width, uint32_t height);
+
+// Colours of the four pixel values (bit n from plane n), as four RGB triples. Single plane
+// displays only use the first two.
+void wm_set_palette(wm_t* wm, const float* palette);
+
+// Scanline darkening and ghosting of the previous frame, 0 to 1 each.
+void wm_set_effects(wm_t* wm, float scanline, float ghost);
+
+// Returns the k_key_* keys currently held.
+uint32_t wm_key_mask(const wm_t* wm);
+
+// Returns the CHIP-8 keypad keys currently held, bit n for key n. The keypad is mapped onto the
+// left of a QWERTY keyboard: 1234 / QWER / ASDF / ZXCV.
+uint16_t wm_keypad(const wm_t* wm);
 
 int wm_should_close(wm_t* wm);
+
+// Sleeps until the next input or window event, then processes it.
+void wm_wait_events(wm_t* wm);
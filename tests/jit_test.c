@@ -0,0 +1,118 @@
+// Runs random ROMs on every platform through the interpreter and the JIT and checks that both end
+// in the same state. Passes without checking anything on hosts the JIT doesn't support.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "program.h"
+
+#define TEST_ROMS 30
+#define TEST_ROM_SIZE 800
+#define TEST_FRAMES 300
+#define TEST_CYCLES_PER_FRAME 100
+
+static uint32_t test_seed = 5;
+
+static uint32_t test_random()
+{
+	test_seed = test_seed * 1103515245u + 12345u;
+	return test_seed >> 16;
+}
+
+// Mostly the ops the JIT emits natively, with enough jumps, draws and stores to reach the
+// interpreter fallbacks and rewrite code
+static uint16_t test_random_op()
+{
+	static const uint16_t alu[] = { 0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0xE };
+	static const uint16_t skips[] = { 0x3000, 0x4000, 0x5000, 0x9000 };
+	static const uint16_t misc[] = { 0x07, 0x0A, 0x15, 0x18, 0x1E, 0x29, 0x33, 0x55, 0x65 };
+	uint16_t r = test_random();
+
+	switch (test_random() % 16)
+	{
+	case 0: return 0x6000 | (r & 0xFFF);
+	case 1: return 0x7000 | (r & 0xFFF);
+	case 2: return 0xA000 | (r & 0xFFF);
+	case 3: return 0xD000 | (r & 0xFFF);
+	case 4: return test_random() % 10 == 0 ? 0x1000 | (0x200 + 2 * (r % (TEST_ROM_SIZE / 2))) : 0x00E0;
+	case 5: return skips[test_random() % 4] | (r & 0xFF0);
+	case 6: return 0xF000 | (r & 0xF00) | misc[test_random() % 9];
+	case 7: return 0xC000 | (r & 0xFFF);
+	default: return 0x8000 | (r & 0xFF0) | alu[test_random() % 9];
+	}
+}
+
+static void test_run(program_t* program)
+{
+	for (int frame = 0; frame < TEST_FRAMES; frame++)
+	{
+		// A program stuck in FX0A runs nothing until its keys change
+		program_set_keys(program, (uint16_t)(frame % 7 == 0 ? 1 << (frame % 16) : 0));
+
+		uint64_t cycles = 0;
+		while (cycles < TEST_CYCLES_PER_FRAME)
+		{
+			program_run_t run = program_run_cycles(program, TEST_CYCLES_PER_FRAME - cycles);
+			if (run.cycles == 0)
+				break;
+			cycles += run.cycles;
+		}
+		program_tick_timers(program);
+	}
+}
+
+int main()
+{
+	for (int t = 0; t < TEST_ROMS; t++)
+	{
+		program_platform_t platform = (program_platform_t)(t % k_program_platform_count);
+
+		// XO-CHIP skips step over both words of F000 NNNN, so put one after half the skips
+		uint8_t rom[TEST_ROM_SIZE];
+		bool skip = false;
+		for (int i = 0; i < TEST_ROM_SIZE; i += 2)
+		{
+			uint16_t op = platform == k_program_platform_xochip && skip && test_random() % 2 ? 0xF000 : test_random_op();
+			rom[i] = op >> 8;
+			rom[i + 1] = op & 0xFF;
+			skip = (op & 0xF000) == 0x3000 || (op & 0xF000) == 0x4000 || (op & 0xF000) == 0x5000 || (op & 0xF000) == 0x9000;
+		}
+
+		program_t* interpreted = program_init_platform(NULL, platform);
+		program_t* compiled = program_init_platform(NULL, platform);
+		if (interpreted == NULL || compiled == NULL
+			|| !program_load_rom(interpreted, rom, sizeof(rom)) || !program_load_rom(compiled, rom, sizeof(rom)))
+			return EXIT_FAILURE;
+
+		if (!program_set_backend(compiled, k_program_backend_jit))
+		{
+			printf("JIT unavailable on this host, nothing to check\n");
+			return EXIT_SUCCESS;
+		}
+
+		test_run(interpreted);
+		test_run(compiled);
+
+		size_t size = program_state_size(interpreted);
+		uint8_t* expected = malloc(size);
+		uint8_t* actual = malloc(size);
+		program_save_state(interpreted, expected, size);
+		program_save_state(compiled, actual, size);
+
+		bool same = memcmp(expected, actual, size) == 0;
+		free(expected);
+		free(actual);
+		if (!same)
+		{
+			printf("ROM %d (%s): interpreted and compiled runs differ\n", t, program_platform_name(platform));
+			return EXIT_FAILURE;
+		}
+
+		program_destroy(interpreted);
+		program_destroy(compiled);
+	}
+
+	printf("%d ROMs: every compiled run matches its interpreted run\n", TEST_ROMS);
+	return EXIT_SUCCESS;
+}
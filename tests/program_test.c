@@ -0,0 +1,121 @@
+// Checks that an instruction the platform lacks stops a run right after it, however the run is
+// cut into blocks: a batched run must end in the same state as stepping one instruction at a time.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "program.h"
+
+typedef struct test_case_t
+{
+	program_platform_t platform;
+	uint16_t op;
+} test_case_t;
+
+// Unknown everywhere, or only implemented by a later platform
+static const test_case_t k_cases[] =
+{
+	{ k_program_platform_chip8, 0x8008 },
+	{ k_program_platform_chip8, 0xF130 },
+	{ k_program_platform_chip8, 0xF175 },
+	{ k_program_platform_chip8, 0xF185 },
+	{ k_program_platform_chip8, 0x5012 },
+	{ k_program_platform_chip8, 0x5013 },
+	{ k_program_platform_chip8, 0xF101 },
+	{ k_program_platform_chip8, 0xF002 },
+	{ k_program_platform_chip8, 0xF13A },
+	{ k_program_platform_schip, 0x8008 },
+	{ k_program_platform_schip, 0x5012 },
+	{ k_program_platform_schip, 0x5013 },
+	{ k_program_platform_schip, 0xF101 },
+	{ k_program_platform_schip, 0xF002 },
+	{ k_program_platform_schip, 0xF13A },
+	{ k_program_platform_xochip, 0x8008 },
+	{ k_program_platform_xochip, 0xE1FF },
+};
+
+static program_t* test_program(const test_case_t* test, program_backend_t backend)
+{
+	// V0 = 5, the bad op, V1 = 7, then loop
+	const uint8_t rom[] = { 0x60, 0x05, test->op >> 8, test->op & 0xFF, 0x61, 0x07, 0x12, 0x06 };
+
+	program_t* program = program_init_platform(NULL, test->platform);
+	if (program == NULL || !program_load_rom(program, rom, sizeof(rom)))
+		exit(EXIT_FAILURE);
+
+	program_set_backend(program, backend);
+	return program;
+}
+
+static bool test_case(const test_case_t* test, program_backend_t backend)
+{
+	program_t* batched = test_program(test, backend);
+	program_t* stepped = test_program(test, backend);
+	bool ok = true;
+
+	program_run_t run = program_run_cycles(batched, 100);
+	if (run.reason != k_program_stop_error || run.cycles != 2)
+	{
+		fprintf(stderr, "%s %04X: batched run stopped after %llu cycles with reason %d\n",
+			program_platform_name(test->platform), test->op, (unsigned long long)run.cycles, run.reason);
+		ok = false;
+	}
+
+	program_run_t first = program_run_cycles(stepped, 1);
+	program_run_t second = program_run_cycles(stepped, 1);
+	if (first.reason != k_program_stop_budget || second.reason != k_program_stop_error)
+	{
+		fprintf(stderr, "%s %04X: stepped run didn't stop on the op\n", program_platform_name(test->platform), test->op);
+		ok = false;
+	}
+
+	size_t size = program_state_size(batched);
+	uint8_t* a = malloc(size);
+	uint8_t* b = malloc(size);
+	if (a == NULL || b == NULL)
+		exit(EXIT_FAILURE);
+
+	program_save_state(batched, a, size);
+	program_save_state(stepped, b, size);
+	if (memcmp(a, b, size) != 0)
+	{
+		fprintf(stderr, "%s %04X: batched and stepped runs differ\n", program_platform_name(test->platform), test->op);
+		ok = false;
+	}
+
+	free(a);
+	free(b);
+	program_destroy(batched);
+	program_destroy(stepped);
+
+	return ok;
+}
+
+int main()
+{
+	program_decode_init();
+
+	bool jit = false;
+	program_t* probe = program_init(NULL);
+	if (probe)
+		jit = program_set_backend(probe, k_program_backend_jit);
+	program_destroy(probe);
+
+	int failures = 0;
+	for (size_t i = 0; i < sizeof(k_cases) / sizeof(k_cases[0]); i++)
+	{
+		failures += !test_case(&k_cases[i], k_program_backend_interpreter);
+		if (jit)
+			failures += !test_case(&k_cases[i], k_program_backend_jit);
+	}
+
+	if (failures)
+	{
+		fprintf(stderr, "%d cases failed\n", failures);
+		return EXIT_FAILURE;
+	}
+
+	printf("Unknown instructions stop runs in place\n");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,127 @@
+// Records a windowed-style run, with key changes landing between frames and while the program is
+// suspended in FX0A, and checks that playing the replay back ends in the same machine state. Also
+// checks that the replay only matches the ROM and platform it was recorded with.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "program.h"
+#include "scheduler.h"
+#include "replay.h"
+
+#define TEST_IPS 700
+#define TEST_REPLAY "replay_test.c8rp"
+
+// Waits for a key, adds it to V2, counts presses in V1 and beeps for a few frames, forever
+static const uint8_t test_rom[] =
+{
+	0xF0, 0x0A,	// 200: V0 = key
+	0x71, 0x01,	// 202: V1 += 1
+	0x82, 0x04,	// 204: V2 += V0
+	0x63, 0x03,	// 206: V3 = 3
+	0xF3, 0x15,	// 208: delay timer = V3
+	0x12, 0x00,	// 20A: jump 200
+};
+
+static program_t* test_program()
+{
+	program_t* program = program_init(NULL);
+	if (program == NULL || !program_load_rom(program, test_rom, sizeof(test_rom)))
+	{
+		fprintf(stderr, "Test: couldn't create the program\n");
+		exit(EXIT_FAILURE);
+	}
+	return program;
+}
+
+static bool test_same_state(const program_t* a, const program_t* b)
+{
+	size_t size = program_state_size(a);
+	uint8_t* state_a = malloc(size);
+	uint8_t* state_b = malloc(size);
+	bool same = state_a && state_b
+		&& program_save_state(a, state_a, size) == size
+		&& program_save_state(b, state_b, size) == size
+		&& memcmp(state_a, state_b, size) == 0;
+	free(state_a);
+	free(state_b);
+	return same;
+}
+
+int main()
+{
+	// Record: the host polls every 5 ms, so most passes run no frame, and changes keys on passes
+	// of its own choosing, many of them while the program is suspended
+	program_t* recorded = test_program();
+	scheduler_t* scheduler = scheduler_init(TEST_IPS);
+	replay_t* replay = replay_record(TEST_REPLAY, TEST_IPS, recorded);
+	if (scheduler == NULL || replay == NULL)
+		return EXIT_FAILURE;
+	scheduler_record(scheduler, replay);
+
+	uint32_t suspended_changes = 0;
+	uint16_t keys = 0;
+	for (uint32_t pass = 0; pass < 2000; pass++)
+	{
+		uint16_t next = (pass % 37 == 0) ? (uint16_t)(1 << (pass % 16)) : (pass % 37 == 11) ? 0 : keys;
+		if (next != keys && scheduler_suspended(scheduler))
+			suspended_changes++;
+		keys = next;
+
+		scheduler_set_keys(scheduler, keys);
+		scheduler_update(scheduler, recorded, pass * 0.005);
+	}
+
+	uint32_t frames = scheduler_frame(scheduler);
+	replay_close(replay, frames);
+	scheduler_terminate(scheduler);
+
+	// Play back frame by frame, as the headless runner does
+	program_t* played = test_program();
+	scheduler = scheduler_init(TEST_IPS);
+	replay = replay_open(TEST_REPLAY);
+	if (scheduler == NULL || replay == NULL || replay_frames(replay) != frames || !replay_matches(replay, played))
+		return EXIT_FAILURE;
+
+	// One byte off, or another platform, and the keys no longer apply
+	program_t* other_rom = program_init(NULL);
+	program_t* other_platform = program_init_platform(NULL, k_program_platform_schip);
+	if (other_rom == NULL || other_platform == NULL
+		|| !program_load_rom(other_rom, test_rom, sizeof(test_rom) - 1)
+		|| !program_load_rom(other_platform, test_rom, sizeof(test_rom))
+		|| replay_matches(replay, other_rom) || replay_matches(replay, other_platform))
+	{
+		printf("Replay matches a ROM or platform it wasn't recorded with\n");
+		return EXIT_FAILURE;
+	}
+	program_destroy(other_rom);
+	program_destroy(other_platform);
+
+	// The batch runner's shared lookup has to agree with the cursor
+	for (uint32_t frame = 0; frame < frames; frame++)
+	{
+		uint16_t keys = replay_keys(replay, frame);
+		if (replay_keys_at(replay, frame) != keys)
+		{
+			printf("Frame %u: shared and cursor lookups differ\n", frame);
+			return EXIT_FAILURE;
+		}
+
+		scheduler_set_keys(scheduler, keys);
+		scheduler_step_frame(scheduler, played);
+	}
+
+	replay_close(replay, 0);
+	scheduler_terminate(scheduler);
+	remove(TEST_REPLAY);
+
+	bool same = test_same_state(recorded, played);
+	printf("%u frames, %u key changes while suspended: %s\n", frames, suspended_changes, same ? "replay matches" : "replay diverges");
+	program_print_state(recorded, stdout);
+
+	program_destroy(recorded);
+	program_destroy(played);
+
+	return same && suspended_changes > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,127 @@
+// Runs random CHIP-8 ROMs on the lockstep engine and on one scalar program per lane, with every
+// lane seeded differently, and checks that each lane ends exactly where its scalar program does.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "program.h"
+#include "wide.h"
+
+#define TEST_ROMS 30
+#define TEST_ROM_SIZE 800
+#define TEST_FRAMES 300
+#define TEST_STEPS_PER_FRAME 7
+
+static uint32_t test_seed = 3;
+
+static uint32_t test_random()
+{
+	test_seed = test_seed * 1103515245u + 12345u;
+	return test_seed >> 16;
+}
+
+// Mostly ALU ops, so lanes share vector groups, with enough skips, jumps, draws and stores to make
+// them diverge and rewrite their code
+static uint16_t test_random_op()
+{
+	static const uint16_t alu[] = { 0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0xE };
+	static const uint16_t skips[] = { 0x3000, 0x4000, 0x5000, 0x9000 };
+	static const uint16_t misc[] = { 0x07, 0x0A, 0x15, 0x18, 0x1E, 0x29, 0x33, 0x55, 0x65 };
+	uint16_t r = test_random();
+
+	switch (test_random() % 16)
+	{
+	case 0: return 0x6000 | (r & 0xFFF);
+	case 1: return 0x7000 | (r & 0xFFF);
+	case 2: return 0xA000 | (r & 0xFFF);
+	case 3: return 0xD000 | (r & 0xFFF);
+	case 4: return test_random() % 10 == 0 ? 0x1000 | (0x200 + 2 * (r % (TEST_ROM_SIZE / 2))) : 0x00E0;
+	case 5: return skips[test_random() % 4] | (r & 0xFF0);
+	case 6: return 0xF000 | (r & 0xF00) | misc[test_random() % 9];
+	case 7: return 0xC000 | (r & 0xFFF);
+	default: return 0x8000 | (r & 0xFF0) | alu[test_random() % 9];
+	}
+}
+
+int main()
+{
+	for (int t = 0; t < TEST_ROMS; t++)
+	{
+		uint8_t rom[TEST_ROM_SIZE];
+		for (int i = 0; i < TEST_ROM_SIZE; i += 2)
+		{
+			uint16_t op = test_random_op();
+			rom[i] = op >> 8;
+			rom[i + 1] = op & 0xFF;
+		}
+
+		uint32_t lanes = 37 + t % 40;
+		wide_t* wide = wide_init_rom(rom, sizeof(rom), lanes);
+		program_t** scalar = calloc(lanes, sizeof(program_t*));
+		if (wide == NULL || scalar == NULL)
+			return EXIT_FAILURE;
+
+		// Seed the registers per lane through the save state, which scalar programs also restore
+		for (uint32_t lane = 0; lane < lanes; lane++)
+		{
+			scalar[lane] = program_init(NULL);
+			if (scalar[lane] == NULL || !program_load_rom(scalar[lane], rom, sizeof(rom)))
+				return EXIT_FAILURE;
+
+			for (int x = 0; x < 16; x++)
+				wide_vars(wide, x)[lane] = (uint8_t)test_random();
+			size_t size = program_state_size(scalar[lane]);
+			uint8_t* state = malloc(size);
+			program_save_state(wide_lane(wide, lane), state, size);
+			program_load_state(scalar[lane], state, size);
+			free(state);
+		}
+
+		for (int frame = 0; frame < TEST_FRAMES; frame++)
+		{
+			wide_run(wide, TEST_STEPS_PER_FRAME);
+			wide_tick_timers(wide);
+
+			// A scalar program stuck in FX0A runs nothing; its lane repeats the wait, to the same effect
+			for (uint32_t lane = 0; lane < lanes; lane++)
+			{
+				uint64_t cycles = 0;
+				while (cycles < TEST_STEPS_PER_FRAME)
+				{
+					program_run_t run = program_run_cycles(scalar[lane], TEST_STEPS_PER_FRAME - cycles);
+					if (run.cycles == 0)
+						break;
+					cycles += run.cycles;
+				}
+				program_tick_timers(scalar[lane]);
+			}
+		}
+
+		for (uint32_t lane = 0; lane < lanes; lane++)
+		{
+			size_t size = program_state_size(scalar[lane]);
+			uint8_t* expected = malloc(size);
+			uint8_t* actual = malloc(size);
+			program_save_state(scalar[lane], expected, size);
+			program_save_state(wide_lane(wide, lane), actual, size);
+
+			bool same = memcmp(expected, actual, size) == 0;
+			free(expected);
+			free(actual);
+			if (!same)
+			{
+				printf("ROM %d, lane %u of %u: lockstep and scalar runs differ\n", t, lane, lanes);
+				return EXIT_FAILURE;
+			}
+
+			program_destroy(scalar[lane]);
+		}
+
+		free(scalar);
+		wide_destroy(wide);
+	}
+
+	printf("%d ROMs: every lane matches its scalar run\n", TEST_ROMS);
+	return EXIT_SUCCESS;
+}